@@ -13,6 +13,7 @@
 void bp_cfg_extra_pins(uint8_t cfg);
 void bp_set_direction(uint8_t direction);
 uint8_t bp_read_state(void);
+uint32_t bp_state_port(uint8_t state);
 void bp_set_state(uint8_t state);
 
 #endif /* __BUSPIRATE_H__ */
@@ -27,6 +27,11 @@ uint8_t ccdbg_exec1(struct ccdbg_state *ctx, uint8_t c);
 uint8_t ccdbg_exec2(struct ccdbg_state *ctx, uint8_t c1, uint8_t c2);
 uint8_t ccdbg_exec3(struct ccdbg_state *ctx, uint8_t c1, uint8_t c2,
 		uint8_t c3);
+bool ccdbg_write_xdata(struct ccdbg_state *ctx, uint16_t addr,
+		const uint8_t *buf, int len);
+uint8_t ccdbg_read_xdata(struct ccdbg_state *ctx, uint16_t addr);
+int ccdbg_read_xdata_inc(struct ccdbg_state *ctx, uint8_t *buf, int len);
+uint8_t ccdbg_burstwrite(struct ccdbg_state *ctx, const uint8_t *buf, int len);
 uint8_t ccdbg_readcfg(struct ccdbg_state *ctx);
 uint8_t ccdbg_writecfg(struct ccdbg_state *ctx, uint8_t c);
 uint8_t ccdbg_chiperase(struct ccdbg_state *ctx);
@@ -37,5 +42,7 @@ uint8_t ccdbg_updateinstr(struct ccdbg_state *ctx, const uint8_t *buf, int ofs,
 		int len);
 uint16_t ccdbg_chipid(struct ccdbg_state *ctx);
 uint16_t ccdbg_getPC(struct ccdbg_state *ctx);
+uint16_t ccdbg_set_clock(struct ccdbg_state *ctx, uint16_t ns);
+int ccdbg_autotune(struct ccdbg_state *ctx);
 
 #endif /* __CCDBG_H__ */
@@ -0,0 +1,35 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ * On-device flash programming for CC253x parts via the debug interface
+ *
+ * Copyright 2021 Jonathan McDowell <noodles@earth.li>
+ */
+#ifndef __CCFLASH_H__
+#define __CCFLASH_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "ccdbg.h"
+
+/* CC253x flash page size */
+#define CCFLASH_PAGE_SIZE	2048
+
+enum ccflash_status {
+	CCFLASH_OK = 0,
+	/** Debug interface error, see ccdbg_error() */
+	CCFLASH_DEBUG,
+	/** DMA transfer didn't complete */
+	CCFLASH_DMA_TIMEOUT,
+	/** Flash controller stayed busy */
+	CCFLASH_BUSY_TIMEOUT,
+	/** Flash controller aborted, e.g. page is locked */
+	CCFLASH_ABORT,
+	/** Bad address or length */
+	CCFLASH_RANGE,
+};
+
+enum ccflash_status ccflash_write_page(struct ccdbg_state *ctx, uint8_t page,
+		const uint8_t *buf, int len, bool erase);
+
+#endif /* __CCFLASH_H__ */
@@ -29,6 +29,8 @@ void cdc_wait_configured(void);
 struct cdc *cdc_open(uint8_t num);
 bool cdc_connected(struct cdc *s, bool wait);
 int cdc_send(struct cdc *s, const uint8_t *buf, int count);
+int cdc_send_more(struct cdc *s, const uint8_t *buf, int count);
+int cdc_send_nowait(struct cdc *s, const uint8_t *buf, int count);
 int cdc_recv(struct cdc *s, uint8_t *buf, uint32_t *timeout);
 int cdc_ss_notify(struct cdc *s, uint16_t state_bits);
 
@@ -0,0 +1,47 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ * Table driven CRC routines
+ *
+ * Copyright 2021 Jonathan McDowell <noodles@earth.li>
+ */
+#ifndef __CRC_H__
+#define __CRC_H__
+
+#include <stdint.h>
+
+extern const uint8_t crc8_maxim_table[256];
+extern const uint16_t crc16_arc_table[256];
+extern const uint32_t crc32_table[256];
+
+/**
+ * Updates a CRC-8/MAXIM (1-Wire ROM ID + scratchpad CRC) with a single
+ * byte, for calculating it on the fly as data is clocked in.
+ */
+static inline uint8_t crc8_maxim_byte(uint8_t crc, uint8_t val)
+{
+	return crc8_maxim_table[crc ^ val];
+}
+
+/**
+ * Updates a CRC-16/ARC (aka CRC-16/IBM, as used by 1-Wire memory devices)
+ * with a single byte.
+ */
+static inline uint16_t crc16_arc_byte(uint16_t crc, uint8_t val)
+{
+	return (crc >> 8) ^ crc16_arc_table[(crc ^ val) & 0xFF];
+}
+
+/**
+ * Updates a raw (uninverted) CRC-32 with a single byte; the caller deals
+ * with the initial and final inversion.
+ */
+static inline uint32_t crc32_byte(uint32_t crc, uint8_t val)
+{
+	return (crc >> 8) ^ crc32_table[(crc ^ val) & 0xFF];
+}
+
+uint8_t crc8_maxim(uint8_t crc, const uint8_t *buf, int len);
+uint16_t crc16_arc(uint16_t crc, const uint8_t *buf, int len);
+uint32_t crc32(uint32_t crc, const uint8_t *buf, int len);
+
+#endif /* __CRC_H__ */
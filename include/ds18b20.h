@@ -0,0 +1,55 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ * Bulk DS18B20 style 1-Wire temperature survey
+ *
+ * Copyright 2021 Jonathan McDowell <noodles@earth.li>
+ */
+#ifndef __DS18B20_H__
+#define __DS18B20_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "w1.h"
+
+#define DS18B20_CONVERT_T	0x44
+#define DS18B20_READ_SCRATCH	0xBE
+
+/** Scratchpad failed its CRC check, temperature is not valid */
+#define DS18B20_CRC_BAD		1
+/** Conversion didn't complete in time, temperature may be stale */
+#define DS18B20_TIMEOUT		2
+
+/* Size of a packed reading: ROM ID, temperature (LE), status */
+#define DS18B20_RECLEN		11
+
+/**
+ * A temperature reading from a single device
+ */
+struct ds18b20_reading {
+	uint8_t devid[8];
+	/** Temperature in 1/16 °C */
+	int16_t temp;
+	/** DS18B20_CRC_BAD / DS18B20_TIMEOUT flags */
+	uint8_t status;
+};
+
+/**
+ * Stores the state of an active survey
+ */
+struct ds18b20_survey {
+	struct w1_search_state search;
+	uint8_t devid[8];
+	/** True if the conversion broadcast completed */
+	bool converted;
+};
+
+bool ds18b20_family(uint8_t family);
+bool ds18b20_convert_all(void);
+bool ds18b20_survey_first(struct ds18b20_survey *survey,
+		struct ds18b20_reading *reading);
+bool ds18b20_survey_next(struct ds18b20_survey *survey,
+		struct ds18b20_reading *reading);
+void ds18b20_pack(const struct ds18b20_reading *reading, uint8_t *buf);
+
+#endif /* __DS18B20_H__ */
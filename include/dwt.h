@@ -11,7 +11,10 @@
 
 #include <stdint.h>
 
+uint32_t dwt_cycles(void);
 void dwt_delay(uint16_t us);
+void dwt_sleep(uint32_t us);
+void dwt_wait_until(uint32_t deadline);
 void dwt_init(void);
 
 #endif /* __DWT_H__ */
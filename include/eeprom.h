@@ -0,0 +1,59 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ * 24Cxx style I2C EEPROM read/program engine
+ *
+ * Copyright 2021 Jonathan McDowell <noodles@earth.li>
+ */
+#ifndef __EEPROM_H__
+#define __EEPROM_H__
+
+#include <stdint.h>
+
+/* Largest page size we support (24C1024) */
+#define EEPROM_MAX_PAGE	256
+
+/**
+ * Geometry of a supported EEPROM part
+ */
+struct eeprom_type {
+	/** Part name, e.g. "24C02" */
+	const char *name;
+	/** Total size in bytes */
+	uint32_t size;
+	/** Page write buffer size in bytes */
+	uint16_t page_size;
+	/** Number of word address bytes sent after the device address */
+	uint8_t addr_bytes;
+};
+
+enum eeprom_status {
+	EEPROM_OK = 0,
+	/** The device failed to ACK part of a transaction */
+	EEPROM_NACK,
+	/** The device didn't finish a write cycle in time */
+	EEPROM_TIMEOUT,
+	/** Data read back didn't match what was written */
+	EEPROM_VERIFY_FAIL,
+	/** Requested range is outside the device */
+	EEPROM_RANGE,
+};
+
+#define EEPROM_TYPE_COUNT	11
+extern const struct eeprom_type eeprom_types[EEPROM_TYPE_COUNT];
+
+struct eeprom_prog;
+
+enum eeprom_status eeprom_read(const struct eeprom_type *type, uint8_t addr,
+		uint32_t ofs, uint8_t *buf, int len);
+enum eeprom_status eeprom_write(const struct eeprom_type *type, uint8_t addr,
+		uint32_t ofs, const uint8_t *buf, int len);
+enum eeprom_status eeprom_verify(const struct eeprom_type *type, uint8_t addr,
+		uint32_t ofs, const uint8_t *buf, int len);
+struct eeprom_prog *eeprom_prog_start(const struct eeprom_type *type,
+		uint8_t addr, uint32_t ofs, uint32_t len);
+enum eeprom_status eeprom_prog_data(struct eeprom_prog *prog,
+		const uint8_t *buf, int len);
+enum eeprom_status eeprom_prog_finish(struct eeprom_prog *prog,
+		uint16_t *crc);
+
+#endif /* __EEPROM_H__ */
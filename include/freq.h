@@ -0,0 +1,46 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ * Frequency / pulse width measurement on the AUX pin
+ *
+ * Copyright 2021 Jonathan McDowell <noodles@earth.li>
+ */
+#ifndef __FREQ_H__
+#define __FREQ_H__
+
+#include <stdint.h>
+
+/* Longest gate time we support; keeps the cycle sums within 32 bits */
+#define FREQ_MAX_GATE_MS	10000
+
+/*
+ * Pulse width histogram bins double in size: bin 0 is under 1µs, bin n
+ * covers 2^(n-1)µs up to 2^nµs, and the last bin takes everything longer.
+ */
+#define FREQ_HIST_BINS		16
+
+struct freq_pulses {
+	/** Number of complete pulses measured */
+	uint32_t count;
+	/** Total, shortest and longest pulse, in DWT cycles */
+	uint32_t sum;
+	uint32_t min;
+	uint32_t max;
+	uint32_t hist[FREQ_HIST_BINS];
+};
+
+struct freq_result {
+	/** Rising edge to rising edge */
+	struct freq_pulses period;
+	struct freq_pulses high;
+	struct freq_pulses low;
+	/** Number of edges seen */
+	uint32_t edges;
+	/** Number of times edges were lost; periods spanning them are dropped */
+	uint32_t missed;
+};
+
+void freq_measure(uint32_t gate_ms, struct freq_result *res);
+uint32_t freq_millihz(const struct freq_result *res);
+uint32_t freq_duty_permille(const struct freq_result *res);
+
+#endif /* __FREQ_H__ */
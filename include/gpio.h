@@ -38,11 +38,16 @@
 
 #endif
 
+/* Bit for a pin within the value returned by gpio_port_get() */
+#define GPIO_MASK(gpio)	(1UL << ((gpio) & 15))
+
 bool gpio_get_direction(uint8_t gpio);
 void gpio_set_input(uint8_t gpio);
 void gpio_set_output(uint8_t gpio, bool open);
 bool gpio_get(uint8_t gpio);
 void gpio_set(uint8_t gpio, bool on);
+uint32_t gpio_port_get(uint8_t gpio);
+void gpio_port_set(uint8_t gpio, uint32_t set, uint32_t clear);
 void bv_gpio_init(void);
 
 #endif /* __GPIO_H__ */
@@ -7,12 +7,73 @@
 #ifndef __I2C_H__
 #define __I2C_H__
 
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Bus speeds, as the half clock period in µs */
+#define I2C_SPEED_5KHZ		100
+#define I2C_SPEED_50KHZ		10
+#define I2C_SPEED_100KHZ	5
+#define I2C_SPEED_400KHZ	1
+
+/**
+ * How to acknowledge the final byte of an i2c_read_buf() call
+ */
+enum i2c_ack_policy {
+	/** ACK the final byte; more data is to follow */
+	I2C_ACK_ALL = 0,
+	/** NACK the final byte; end of the read */
+	I2C_NACK_LAST,
+	/** Don't send an (n)ack for the final byte; the caller will */
+	I2C_ACK_DEFER,
+};
+
+/**
+ * The type of probe used by i2c_scan()
+ */
+enum i2c_scan_mode {
+	/** Address + write bit, then stop */
+	I2C_SCAN_QUICK_WRITE = 0,
+	/** Address + read bit, NACK the first byte, then stop */
+	I2C_SCAN_READ,
+	/** Read probes for write sensitive address ranges, quick write else */
+	I2C_SCAN_AUTO,
+};
+
+/*
+ * Bus monitor records are I2C_MON_RECLEN bytes: a type byte, a data byte,
+ * and a 32 bit little endian DWT cycle count timestamp (MHZ cycles per µs).
+ */
+#define I2C_MON_RECLEN		6
+/** Start (or repeated start) condition */
+#define I2C_MON_START		'S'
+/** Stop condition */
+#define I2C_MON_STOP		'P'
+/** Data byte, ACKed */
+#define I2C_MON_ACK		'A'
+/** Data byte, NACKed */
+#define I2C_MON_NACK		'N'
+/** Edges were missed while not sampling; ignoring bus until next start */
+#define I2C_MON_RESYNC		'R'
+/** Records were dropped; timestamp field holds the total dropped count */
+#define I2C_MON_OVERFLOW	'O'
+
 void i2c_start(void);
 void i2c_stop(void);
 bool i2c_read_bit(void);
 void i2c_write_bit(bool bit);
 uint8_t i2c_read(void);
 bool i2c_write(uint8_t val);
+int i2c_write_buf(const uint8_t *buf, int len, bool ignore_nack);
+void i2c_read_buf(uint8_t *buf, int len, enum i2c_ack_policy policy);
+bool i2c_xfer(uint8_t addr, const uint8_t *wbuf, int wlen,
+		uint8_t *rbuf, int rlen);
+void i2c_scan(uint8_t bitmap[16], enum i2c_scan_mode mode);
+void i2c_monitor_start(void);
+void i2c_monitor_trigger(uint8_t addr, uint8_t mask);
+int i2c_monitor_capture(uint8_t *buf, int size, uint32_t idle_us);
+uint32_t i2c_monitor_dropped(void);
+void i2c_set_speed(uint8_t speed);
 bool i2c_pullups_ok(void);
 void i2c_init(uint8_t scl, uint8_t sda);
 
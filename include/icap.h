@@ -0,0 +1,24 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ * Input capture of edges on the AUX pin
+ *
+ * Copyright 2021 Jonathan McDowell <noodles@earth.li>
+ */
+#ifndef __ICAP_H__
+#define __ICAP_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct icap_edge {
+	/** When the edge happened, in DWT cycles */
+	uint32_t t;
+	bool rising;
+};
+
+void icap_start(void);
+bool icap_next(struct icap_edge *edge);
+uint32_t icap_missed(void);
+void icap_stop(void);
+
+#endif /* __ICAP_H__ */
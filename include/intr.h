@@ -10,8 +10,8 @@
 #define __INTR_H__
 
 #ifdef GNU_LINUX_EMULATION
-#define __disable_irq()
-#define __enable_irq()
+#define __disable_irq() do { } while (0)
+#define __enable_irq() do { } while (0)
 #else
 #define __disable_irq() asm volatile ("cpsid i" : : : "memory")
 #define __enable_irq() asm volatile ("cpsie i" : : : "memory")
@@ -0,0 +1,80 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ * Logic analyser sampling engine
+ *
+ * Copyright 2021 Jonathan McDowell <noodles@earth.li>
+ */
+#ifndef __LA_H__
+#define __LA_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "trigger.h"
+
+/*
+ * Samples are a byte of the port the probe pins are on. On the STM32 this is
+ * PB8-PB15; in emulation it's the emulated pin numbers.
+ */
+#define LA_CHANNELS	8
+
+#ifdef GNU_LINUX_EMULATION
+#define LA_CH_AUX	0x01
+#define LA_CH_MOSI	0x02
+#define LA_CH_CLK	0x04
+#define LA_CH_MISO	0x08
+#define LA_CH_CS	0x10
+#else
+#define LA_CH_AUX	0x01
+#define LA_CH_CS	0x10
+#define LA_CH_CLK	0x20
+#define LA_CH_MISO	0x40
+#define LA_CH_MOSI	0x80
+#endif
+
+/* Roughly how fast the sampling loop can go */
+#define LA_MAX_RATE	(MHZ * 1000000 / 24)
+
+struct la_config {
+	/** Sample rate, in Hz */
+	uint32_t rate;
+	/** Number of samples to keep, clipped to la_max_samples() */
+	uint32_t samples;
+	/** Number of those samples to take after the trigger */
+	uint32_t post;
+	/** Trigger on LA_CH_* sample bits; NULL to start straight away */
+	struct trigger *trig;
+};
+
+/*
+ * Streaming capture records. A state record is a pin state byte (LA_PIN_*
+ * bits) followed by a varint (LEB128) count of DWT cycles since the
+ * previous state record; one is sent at least every 2^30 cycles even with
+ * no transitions. A first byte with the top bit set is a control record.
+ */
+#define LA_PIN_AUX	0x01
+#define LA_PIN_MOSI	0x02
+#define LA_PIN_CLK	0x04
+#define LA_PIN_MISO	0x08
+#define LA_PIN_CS	0x10
+/** Always first; varint DWT cycles per second */
+#define LA_REC_CLOCK	0x80
+/** Varint count of transitions dropped; the next state record resyncs */
+#define LA_REC_OVERFLOW	0x81
+/** Capture stopped, no varint */
+#define LA_REC_END	0x82
+
+uint32_t la_max_samples(void);
+void la_start(const struct la_config *cfg);
+bool la_run(uint32_t samples);
+uint32_t la_count(void);
+uint8_t la_get(uint32_t n);
+
+void la_stream_start(void);
+bool la_stream_run(uint32_t usec);
+void la_stream_flush(void);
+bool la_stream_stop(void);
+const uint8_t *la_stream_packet(int *len);
+void la_stream_release(void);
+
+#endif /* __LA_H__ */
@@ -0,0 +1,31 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ * Pattern generator; replays pin state vectors at a fixed rate
+ *
+ * Copyright 2021 Jonathan McDowell <noodles@earth.li>
+ */
+#ifndef __PATTERN_H__
+#define __PATTERN_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Roughly how fast the output loop can go */
+#define PATTERN_MAX_RATE	(MHZ * 1000000 / 48)
+
+enum pattern_status {
+	/** Vectors are being output; keep feeding them in without blocking */
+	PATTERN_BUSY,
+	/** Nothing can be output until more vectors arrive */
+	PATTERN_NEED_DATA,
+	/** All vectors have been output */
+	PATTERN_DONE,
+};
+
+bool pattern_start(uint32_t rate, uint32_t count);
+uint32_t pattern_wanted(void);
+int pattern_fill(const uint8_t *buf, int len);
+enum pattern_status pattern_run(uint32_t usec);
+uint32_t pattern_underruns(void);
+
+#endif /* __PATTERN_H__ */
@@ -0,0 +1,72 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ * Multi-stage trigger engine shared by the capture and monitor modes
+ *
+ * Copyright 2021 Jonathan McDowell <noodles@earth.li>
+ */
+#ifndef __TRIGGER_H__
+#define __TRIGGER_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TRIGGER_MAX_STAGES	12
+
+/*
+ * Triggers look at a 16 bit word made up of the previous sample in the top
+ * byte and the current one in the bottom, so edges are just another mask
+ * compare. Use these to build masks from sample bits.
+ */
+#define TRIGGER_CUR(bits)	((uint16_t) (bits))
+#define TRIGGER_PREV(bits)	((uint16_t) ((bits) << 8))
+
+struct trigger_stage {
+	/** Stage matches when (word & mask) == value ... */
+	uint16_t mask;
+	uint16_t value;
+	/** ... for count samples in a row */
+	uint32_t count;
+	/** On a match, restart from stage 0 unless (word & check) == expect */
+	uint16_t check;
+	uint16_t expect;
+};
+
+struct trigger {
+	struct trigger_stage stage[TRIGGER_MAX_STAGES];
+	int stages;
+
+	/* Current stage, loaded into the fast path fields below */
+	int cur;
+	uint16_t mask;
+	uint16_t value;
+	uint32_t need;
+	uint32_t run;
+};
+
+void trigger_init(struct trigger *t);
+bool trigger_add_pattern(struct trigger *t, uint8_t mask, uint8_t value,
+		uint32_t count);
+bool trigger_add_edge(struct trigger *t, uint8_t bit, bool rising);
+bool trigger_add_i2c_addr(struct trigger *t, uint8_t scl, uint8_t sda,
+		uint8_t addr, uint8_t mask);
+bool trigger_add_w1_reset(struct trigger *t, uint8_t bit, uint32_t count);
+void trigger_arm(struct trigger *t);
+bool trigger_advance(struct trigger *t, uint16_t word);
+
+/**
+ * Feeds a sample word to the trigger. The only branch in the common case is
+ * the count compare; stage changes are handled out of line.
+ *
+ * :param word: Previous sample << 8 | current sample
+ * :return: True once the final stage has matched
+ */
+static inline bool trigger_sample(struct trigger *t, uint16_t word)
+{
+	t->run = (t->run + 1) * ((word & t->mask) == t->value);
+	if (t->run < t->need)
+		return false;
+
+	return trigger_advance(t, word);
+}
+
+#endif /* __TRIGGER_H__ */
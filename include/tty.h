@@ -18,6 +18,7 @@ void tty_printf(struct cdc *tty, const char *str);
 void tty_putc(struct cdc *tty, const char c);
 void tty_printbin(struct cdc *tty, int val);
 void tty_printdec(struct cdc *tty, int val);
+void tty_printudec(struct cdc *tty, uint32_t val);
 void tty_printhex(struct cdc *tty, unsigned int val, int places);
 int tty_readline(struct cdc *tty, char *line, int linesize);
 
@@ -11,6 +11,10 @@
 #include <stdint.h>
 
 #define W1_READ_ROM	0x33
+#define W1_MATCH_ROM	0x55
+#define W1_SKIP_ROM	0xCC
+#define W1_OD_SKIP_ROM	0x3C
+#define W1_OD_MATCH_ROM	0x69
 #define W1_ALARM_SEARCH	0xEC
 #define W1_ROM_SEARCH	0xF0
 
@@ -20,6 +24,23 @@ enum w1_present_state {
 	W1_NO_PULLUP,
 };
 
+enum w1_speed {
+	W1_SPEED_STANDARD = 0,
+	W1_SPEED_OVERDRIVE,
+};
+
+/**
+ * Counts of slots where timing ran late
+ */
+struct w1_stats {
+	/** Write slots where the low phase ran long */
+	uint32_t write_overruns;
+	/** Read slots that were sampled late */
+	uint32_t read_overruns;
+	/** Resets where presence was sampled late */
+	uint32_t reset_overruns;
+};
+
 /**
  * Stores the state of an active 1-wire search process
  */
@@ -32,7 +53,52 @@ struct w1_search_state {
 	uint8_t search_type;
 };
 
-uint8_t w1_crc(uint8_t *buf, uint8_t len);
+/** Maximum number of devices cached by w1_scan() / w1_rescan() */
+#define W1_MAX_DEVICES	64
+
+/** Device was found by the last scan */
+#define W1_DEV_NEW	1
+/** Device was missing on the last rescan */
+#define W1_DEV_GONE	2
+
+/**
+ * A cached 1-Wire device
+ */
+struct w1_device {
+	uint8_t devid[8];
+	/** W1_DEV_NEW / W1_DEV_GONE from the last scan */
+	uint8_t flags;
+};
+
+/**
+ * The set of devices found on the bus, kept between scans
+ */
+struct w1_devlist {
+	/** Type of the search (W1_ALARM_SEARCH / W1_ROM_SEARCH) */
+	uint8_t search_type;
+	/** True if more devices were found than we could store */
+	bool overflow;
+	/** Flips each rescan, to alternate the paths walked */
+	bool odd;
+	int count;
+	struct w1_device dev[W1_MAX_DEVICES];
+};
+
+/** Maximum number of buses driven in parallel by the w1_multi_* routines */
+#define W1_MULTI_MAX	8
+
+/**
+ * Stores the state of a parallel search across several buses
+ */
+struct w1_multi_search_state {
+	/** Type of the search (W1_ALARM_SEARCH / W1_ROM_SEARCH) */
+	uint8_t search_type;
+	/** Bitmap of buses with no more devices to find */
+	uint8_t done;
+	/** Last bit position we had both high + low options, per bus */
+	int last_discrepancy[W1_MULTI_MAX];
+};
+
 void w1_write(uint8_t val);
 bool w1_read_bit(void);
 uint8_t w1_read_byte(void);
@@ -41,6 +107,22 @@ enum w1_present_state w1_reset(bool nowait);
 bool w1_find_first(uint8_t cmd, struct w1_search_state *state,
 		uint8_t devid[8]);
 bool w1_find_next(struct w1_search_state *state, uint8_t devid[8]);
+struct w1_devlist *w1_scan(uint8_t cmd);
+struct w1_devlist *w1_rescan(bool full);
+bool w1_multi_init(const uint8_t *gpios, int count);
+uint8_t w1_multi_reset(uint8_t buses);
+void w1_multi_write(uint8_t buses, uint8_t val);
+uint8_t w1_multi_read_bit(uint8_t buses);
+void w1_multi_read(uint8_t buses, uint8_t *vals);
+uint8_t w1_multi_find_first(uint8_t cmd, struct w1_multi_search_state *state,
+		uint8_t devid[][8]);
+uint8_t w1_multi_find_next(struct w1_multi_search_state *state,
+		uint8_t devid[][8]);
+void w1_set_speed(enum w1_speed speed);
+enum w1_speed w1_get_speed(void);
+void w1_get_stats(struct w1_stats *stats, bool clear);
+enum w1_present_state w1_overdrive_skip(void);
+enum w1_present_state w1_overdrive_match(const uint8_t devid[8]);
 void w1_init(uint8_t gpio);
 
 #endif /* __W1_H__ */
@@ -12,6 +12,8 @@
 #include "cdc.h"
 #include "debug.h"
 #include "gpio.h"
+#include "la.h"
+#include "pattern.h"
 
 void bpbin_err(struct cdc *tty)
 {
@@ -25,6 +27,27 @@ void bpbin_ok(struct cdc *tty)
 	cdc_send(tty, &resp, 1);
 }
 
+/**
+ * Returns the next byte from the command stream, receiving a new packet if
+ * we've run out.
+ *
+ * :param buf: Receive buffer
+ * :param i: Index of the last consumed byte in buf; updated
+ * :param len: Number of valid bytes in buf; updated
+ * :return: The next byte, or -1 if the host disconnected
+ */
+int bpbin_next(struct cdc *tty, uint8_t *buf, int *i, int *len)
+{
+	while (++(*i) >= *len) {
+		*len = cdc_recv(tty, buf, NULL);
+		if (*len < 0)
+			return -1;
+		*i = -1;
+	}
+
+	return buf[*i];
+}
+
 static void bpbin_send_bbio1(struct cdc *tty)
 {
 	cdc_send(tty, (uint8_t *) "BBIO1", 5);
@@ -52,6 +75,132 @@ static uint8_t bpbin_selftest(struct cdc *tty, uint8_t *buf, bool quick)
 	return 0;
 }
 
+/*
+ * Pattern generator (0x0D). Followed by a big endian 32 bit output rate in
+ * Hz and a big endian 32 bit vector count. We respond 0x01 (or 0x00 if the
+ * rate isn't supported), then the host streams that many vectors, one byte
+ * each in the same layout as the 0x80 command, which are output at the
+ * requested rate. Once they've all been output we send 0x01 and a big endian
+ * 32 bit count of times the host didn't keep up.
+ *
+ * :return: False if the host disconnected, true otherwise
+ */
+static bool bpbin_pattern(struct cdc *tty, uint8_t *buf, int *i, int *len)
+{
+	enum pattern_status status;
+	uint32_t rate, count, timeout, underruns;
+	uint8_t resp[5];
+	int c, n, r;
+
+	rate = count = 0;
+	for (n = 0; n < 8; n++) {
+		c = bpbin_next(tty, buf, i, len);
+		if (c < 0)
+			return false;
+		if (n < 4)
+			rate = rate << 8 | c;
+		else
+			count = count << 8 | c;
+	}
+
+	if (!pattern_start(rate, count)) {
+		bpbin_err(tty);
+		return true;
+	}
+	bpbin_ok(tty);
+
+	/*
+	 * The ring buffer holds the vectors being output, and buf holds the
+	 * next packet while it waits for room. Only block on the host when
+	 * there's nothing to output.
+	 */
+	while ((status = pattern_run(100)) != PATTERN_DONE) {
+		if (*i + 1 < *len) {
+			*i += pattern_fill(&buf[*i + 1], *len - (*i + 1));
+			continue;
+		}
+		if (pattern_wanted() == 0)
+			continue;
+
+		timeout = 0;
+		r = cdc_recv(tty, buf, (status == PATTERN_NEED_DATA) ?
+				NULL : &timeout);
+		if (r < 0)
+			return false;
+		if (r > 0) {
+			*len = r;
+			*i = -1;
+		}
+	}
+
+	underruns = pattern_underruns();
+	resp[0] = 1;
+	resp[1] = underruns >> 24;
+	resp[2] = (underruns >> 16) & 0xFF;
+	resp[3] = (underruns >> 8) & 0xFF;
+	resp[4] = underruns & 0xFF;
+	cdc_send(tty, resp, sizeof(resp));
+
+	return true;
+}
+
+/*
+ * Streaming transition capture (0x0E). Replies 0x01, then streams LA_REC_*
+ * records until the host sends any byte, finishing with LA_REC_END. Packets
+ * are only handed to the endpoint when it's free, so we never stop watching
+ * the pins to wait for the host; if it falls behind we report how many
+ * transitions were dropped.
+ *
+ * :return: False if the host disconnected, true otherwise
+ */
+static bool bpbin_stream(struct cdc *tty, uint8_t *buf)
+{
+	const uint8_t *pkt;
+	uint32_t timeout;
+	int len, r, ticks;
+	bool ended;
+
+	bpbin_ok(tty);
+	la_stream_start();
+
+	ticks = 0;
+	while (1) {
+		la_stream_run(1000);
+		while ((pkt = la_stream_packet(&len)) != NULL) {
+			r = cdc_send_nowait(tty, pkt, len);
+			if (r < 0)
+				return false;
+			if (r == 0)
+				break;
+			la_stream_release();
+		}
+
+		/* Every ~10ms push out what we have and check for stop */
+		if (++ticks < 10)
+			continue;
+		ticks = 0;
+		la_stream_flush();
+
+		timeout = 0;
+		len = cdc_recv(tty, buf, &timeout);
+		if (len < 0)
+			return false;
+		if (len > 0)
+			break;
+	}
+
+	ended = la_stream_stop();
+	while ((pkt = la_stream_packet(&len)) != NULL) {
+		if (cdc_send(tty, pkt, len) < 0)
+			return false;
+		la_stream_release();
+		if (!ended)
+			ended = la_stream_stop();
+	}
+
+	return true;
+}
+
 bool bpbin_main(struct cdc *tty)
 {
 	uint8_t buf[CDC_BUFSIZE];
@@ -111,9 +260,19 @@ bool bpbin_main(struct cdc *tty)
 				case 10:
 				case 11:
 				case 12:
+					/* Unused */
+					break;
 				case 13:
+					/* Pattern generator */
+					if (!bpbin_pattern(tty, buf, &i, &len))
+						return false;
+					break;
 				case 14:
-					/* Unused */
+					/* Streaming transition capture */
+					debug_print("Entering streaming capture.\r\n");
+					if (!bpbin_stream(tty, buf))
+						return false;
+					len = 0;
 					break;
 				case 0xF:
 					bpbin_ok(tty);
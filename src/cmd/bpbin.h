@@ -11,6 +11,7 @@
 
 void bpbin_err(struct cdc *tty);
 void bpbin_ok(struct cdc *tty);
+int bpbin_next(struct cdc *tty, uint8_t *buf, int *i, int *len);
 void bpbin_i2c(struct cdc *tty, uint8_t *buf);
 void bpbin_raw(struct cdc *tty, uint8_t *buf);
 void bpbin_w1(struct cdc *tty, uint8_t *buf);
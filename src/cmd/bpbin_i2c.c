@@ -7,10 +7,14 @@
  * Copyright 2021 Jonathan McDowell <noodles@earth.li>
  */
 
+#include <string.h>
+
 #include "bpbin.h"
 #include "buspirate.h"
 #include "cdc.h"
+#include "crc.h"
 #include "debug.h"
+#include "eeprom.h"
 #include "gpio.h"
 #include "i2c.h"
 
@@ -19,10 +23,249 @@ static void bpbin_send_i2c1(struct cdc *tty)
 	cdc_send(tty, (uint8_t *) "I2C1", 4);
 }
 
+/*
+ * Write then read command (0x08): start, write 0-4096 bytes, read 0-4096
+ * bytes (NACKing the last), stop. Write data is clocked out as it arrives
+ * and read data is streamed back in USB packet sized chunks rather than
+ * buffering the whole transfer.
+ *
+ * :return: False if the host disconnected, true otherwise
+ */
+static bool bpbin_i2c_write_read(struct cdc *tty, uint8_t *buf, int *i,
+		int *len)
+{
+	uint8_t data[CDC_BUFSIZE];
+	int wlen, rlen, chunk, c, n;
+	bool ok;
+
+	/* Big endian write length, then read length */
+	wlen = rlen = 0;
+	for (n = 0; n < 4; n++) {
+		c = bpbin_next(tty, buf, i, len);
+		if (c < 0)
+			return false;
+		if (n < 2)
+			wlen = wlen << 8 | c;
+		else
+			rlen = rlen << 8 | c;
+	}
+
+	if (wlen > 4096 || rlen > 4096) {
+		bpbin_err(tty);
+		return true;
+	}
+
+	i2c_start();
+	ok = true;
+	while (wlen > 0) {
+		if (*i + 1 >= *len) {
+			*len = cdc_recv(tty, buf, NULL);
+			if (*len < 0)
+				return false;
+			*i = -1;
+			continue;
+		}
+
+		chunk = *len - (*i + 1);
+		if (chunk > wlen)
+			chunk = wlen;
+
+		/* Keep consuming the write data after a NACK, but drop it */
+		if (ok)
+			ok = i2c_write_buf(&buf[*i + 1], chunk, false) == chunk;
+		*i += chunk;
+		wlen -= chunk;
+	}
+
+	if (!ok) {
+		i2c_stop();
+		bpbin_err(tty);
+		return true;
+	}
+
+	bpbin_ok(tty);
+	if (rlen == 0)
+		i2c_stop();
+
+	while (rlen > 0) {
+		chunk = (rlen > CDC_BUFSIZE) ? CDC_BUFSIZE : rlen;
+		rlen -= chunk;
+
+		i2c_read_buf(data, chunk, rlen ? I2C_ACK_ALL : I2C_NACK_LAST);
+		if (rlen == 0)
+			i2c_stop();
+
+		if (cdc_send(tty, data, chunk) < 0)
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * Consumes len bytes of EEPROM image data from the host, feeding it to prog
+ * if it's not NULL.
+ *
+ * :return: False if the host disconnected, true otherwise
+ */
+static bool bpbin_i2c_image(struct cdc *tty, uint8_t *buf, int *i, int *len,
+		uint32_t left, struct eeprom_prog *prog)
+{
+	int chunk;
+
+	while (left > 0) {
+		if (*i + 1 >= *len) {
+			*len = cdc_recv(tty, buf, NULL);
+			if (*len < 0)
+				return false;
+			*i = -1;
+			continue;
+		}
+
+		chunk = *len - (*i + 1);
+		if ((uint32_t) chunk > left)
+			chunk = left;
+
+		if (prog != NULL)
+			eeprom_prog_data(prog, &buf[*i + 1], chunk);
+		*i += chunk;
+		left -= chunk;
+	}
+
+	return true;
+}
+
+/*
+ * EEPROM dump (0x0C) / program (0x0D) commands. Followed by an 8 byte
+ * header: 7-bit device address, EEPROM type index, 24 bit big endian start
+ * offset, 24 bit big endian length. We respond 0x01 (or 0x00 if the header
+ * is invalid, after which a program image is discarded), then for a dump
+ * stream the data back (0xFF padded after a failure) or for a program consume
+ * the image data, and finally return a status byte and the big endian
+ * CRC-16/ARC of the range.
+ *
+ * :return: False if the host disconnected, true otherwise
+ */
+static bool bpbin_i2c_eeprom(struct cdc *tty, uint8_t *buf, int *i, int *len,
+		bool program)
+{
+	const struct eeprom_type *type;
+	struct eeprom_prog *prog;
+	enum eeprom_status status;
+	uint8_t hdr[8];
+	uint8_t data[CDC_BUFSIZE];
+	uint32_t ofs, left;
+	uint16_t crc;
+	int c, chunk, n;
+
+	for (n = 0; n < 8; n++) {
+		c = bpbin_next(tty, buf, i, len);
+		if (c < 0)
+			return false;
+		hdr[n] = c;
+	}
+
+	ofs = hdr[2] << 16 | hdr[3] << 8 | hdr[4];
+	left = hdr[5] << 16 | hdr[6] << 8 | hdr[7];
+
+	if (hdr[0] > 0x7F || hdr[1] >= EEPROM_TYPE_COUNT) {
+		bpbin_err(tty);
+		/* The image still follows; don't treat it as commands */
+		return !program || bpbin_i2c_image(tty, buf, i, len, left,
+				NULL);
+	}
+	type = &eeprom_types[hdr[1]];
+	bpbin_ok(tty);
+
+	crc = 0;
+	if (program) {
+		prog = eeprom_prog_start(type, hdr[0], ofs, left);
+		if (!bpbin_i2c_image(tty, buf, i, len, left, prog))
+			return false;
+		status = eeprom_prog_finish(prog, &crc);
+	} else {
+		status = EEPROM_OK;
+		while (left > 0) {
+			chunk = (left > CDC_BUFSIZE) ? CDC_BUFSIZE : left;
+
+			if (status == EEPROM_OK)
+				status = eeprom_read(type, hdr[0], ofs, data,
+						chunk);
+			if (status == EEPROM_OK)
+				crc = crc16_arc(crc, data, chunk);
+			else
+				memset(data, 0xFF, chunk);
+
+			/* The status below completes the transfer */
+			if (cdc_send_more(tty, data, chunk) < 0)
+				return false;
+			ofs += chunk;
+			left -= chunk;
+		}
+	}
+
+	data[0] = status;
+	data[1] = crc >> 8;
+	data[2] = crc & 0xFF;
+	cdc_send(tty, data, 3);
+
+	return true;
+}
+
+/*
+ * Timestamped bus monitor (0x0E). Leaves SCL/SDA as inputs and streams
+ * I2C_MON_RECLEN byte records in batches until the host sends any byte, then
+ * sends a final I2C_MON_OVERFLOW record with the total dropped count.
+ *
+ * :return: False if the host disconnected, true otherwise
+ */
+static bool bpbin_i2c_monitor(struct cdc *tty, uint8_t *buf)
+{
+	static uint8_t records[1536];
+	uint32_t timeout;
+	int len;
+
+	i2c_monitor_start();
+	bpbin_ok(tty);
+
+	while (1) {
+		/* Drain at least every 10ms so the host sees progress */
+		len = i2c_monitor_capture(records, sizeof(records), 10000);
+		if (len > 0 && cdc_send(tty, records, len) < 0)
+			return false;
+
+		timeout = 0;
+		len = cdc_recv(tty, buf, &timeout);
+		if (len < 0)
+			return false;
+		if (len > 0)
+			break;
+	}
+
+	records[0] = I2C_MON_OVERFLOW;
+	records[1] = 0;
+	records[2] = i2c_monitor_dropped() & 0xFF;
+	records[3] = (i2c_monitor_dropped() >> 8) & 0xFF;
+	records[4] = (i2c_monitor_dropped() >> 16) & 0xFF;
+	records[5] = (i2c_monitor_dropped() >> 24) & 0xFF;
+	cdc_send(tty, records, I2C_MON_RECLEN);
+
+	/* Back to driving the bus */
+	i2c_init(PIN_CLK, PIN_MOSI);
+
+	return true;
+}
+
 void bpbin_i2c(struct cdc *tty, uint8_t *buf)
 {
-	int i, len;
+	int i, j, len;
 	uint8_t resp;
+	uint8_t acks[16];
+	uint8_t scan[17];
+	static const uint8_t speeds[] = {
+		I2C_SPEED_5KHZ, I2C_SPEED_50KHZ,
+		I2C_SPEED_100KHZ, I2C_SPEED_400KHZ,
+	};
 
 	i2c_init(PIN_CLK, PIN_MOSI);
 	bpbin_send_i2c1(tty);
@@ -47,8 +290,8 @@ void bpbin_i2c(struct cdc *tty, uint8_t *buf)
 				i2c_stop();
 				bpbin_ok(tty);
 			} else if (buf[i] == 4) {
-				/* Read byte */
-				resp = i2c_read();
+				/* Read byte, host sends the (n)ack */
+				i2c_read_buf(&resp, 1, I2C_ACK_DEFER);
 				cdc_send(tty, &resp, 1);
 			} else if (buf[i] == 6) {
 				/* ACK bit */
@@ -58,31 +301,73 @@ void bpbin_i2c(struct cdc *tty, uint8_t *buf)
 				/* NACK bit */
 				i2c_write_bit(true);
 				bpbin_ok(tty);
+			} else if (buf[i] == 8) {
+				/* Write then read */
+				if (!bpbin_i2c_write_read(tty, buf, &i, &len))
+					return;
 			} else if ((buf[i] & 0xF0) == 0x10) {
 				/* Send 1-16 bytes */
 				int left = (buf[i] & 0xF) + 1;
+				int n, acked;
 
 				bpbin_ok(tty);
 
+				/*
+				 * Clock out everything we've already received
+				 * and return the (n)acks in a single packet.
+				 */
 				while (left) {
-					i++;
-					if (i < len) {
-						resp = i2c_write(buf[i]) ? 1 : 0;
-						cdc_send(tty, &resp, 1);
-						left--;
-					} else {
+					if (i + 1 >= len) {
 						len = cdc_recv(tty, buf, NULL);
 						if (len < 0)
 							return;
-						i = 0;
+						i = -1;
+						continue;
 					}
+
+					n = len - (i + 1);
+					if (n > left)
+						n = left;
+
+					/* Restart after a NACK to report each one */
+					j = 0;
+					while (j < n) {
+						acked = i2c_write_buf(&buf[i + 1 + j],
+								n - j, false);
+						memset(&acks[j], 0, acked);
+						j += acked;
+						if (j < n)
+							acks[j++] = 1;
+					}
+					i += n;
+					left -= n;
+					cdc_send(tty, acks, n);
 				}
 			} else if ((buf[i] & 0xF0) == 0x40) {
 				/* Configure peripheral pins */
 				bp_cfg_extra_pins(buf[i] & 0xF);
 				bpbin_ok(tty);
+			} else if (buf[i] == 0x0A || buf[i] == 0x0B) {
+				/* Address scan, quick write / read probes */
+				scan[0] = 1;
+				i2c_scan(&scan[1], (buf[i] & 1) ?
+						I2C_SCAN_READ :
+						I2C_SCAN_QUICK_WRITE);
+				cdc_send(tty, scan, sizeof(scan));
+			} else if (buf[i] == 0x0C || buf[i] == 0x0D) {
+				/* EEPROM dump / program */
+				if (!bpbin_i2c_eeprom(tty, buf, &i, &len,
+						buf[i] & 1))
+					return;
+			} else if (buf[i] == 0x0E) {
+				/* Timestamped bus monitor, discards rest of buf */
+				if (!bpbin_i2c_monitor(tty, buf))
+					return;
+				break;
 			} else if ((buf[i] & 0xFC) == 0x60) {
 				/* Set speed */
+				i2c_set_speed(speeds[buf[i] & 3]);
+				bpbin_ok(tty);
 			} else {
 				bpbin_err(tty);
 			}
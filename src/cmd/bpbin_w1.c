@@ -13,6 +13,7 @@
 #include "buspirate.h"
 #include "cdc.h"
 #include "debug.h"
+#include "ds18b20.h"
 #include "gpio.h"
 #include "w1.h"
 
@@ -21,11 +22,139 @@ static void bpbin_send_1w10(struct cdc *tty)
 	cdc_send(tty, (uint8_t *) "1W01", 4);
 }
 
+/*
+ * Surveys every temperature sensor on the bus, streaming packed readings
+ * several to a packet, followed by a record of all 0xFF.
+ */
+static void bpbin_w1_survey(struct cdc *tty)
+{
+	struct ds18b20_survey survey;
+	struct ds18b20_reading reading;
+	uint8_t out[(CDC_BUFSIZE / DS18B20_RECLEN) * DS18B20_RECLEN];
+	int pos;
+	bool found;
+
+	bpbin_ok(tty);
+
+	pos = 0;
+	found = ds18b20_survey_first(&survey, &reading);
+	while (found) {
+		ds18b20_pack(&reading, &out[pos]);
+		pos += DS18B20_RECLEN;
+		if (pos == sizeof(out)) {
+			cdc_send(tty, out, pos);
+			pos = 0;
+		}
+
+		found = ds18b20_survey_next(&survey, &reading);
+	}
+
+	memset(&out[pos], 0xFF, DS18B20_RECLEN);
+	cdc_send(tty, out, pos + DS18B20_RECLEN);
+}
+
+/*
+ * Bulk read (0x0C). Followed by a 16 bit big endian length (1-4096); the
+ * data is streamed back in USB packet sized chunks.
+ *
+ * :return: False if the host disconnected, true otherwise
+ */
+static bool bpbin_w1_read(struct cdc *tty, uint8_t *buf, int *i, int *len)
+{
+	uint8_t data[CDC_BUFSIZE];
+	int rlen, chunk, c, n;
+
+	rlen = 0;
+	for (n = 0; n < 2; n++) {
+		c = bpbin_next(tty, buf, i, len);
+		if (c < 0)
+			return false;
+		rlen = rlen << 8 | c;
+	}
+
+	if (rlen == 0 || rlen > 4096) {
+		bpbin_err(tty);
+		return true;
+	}
+
+	while (rlen > 0) {
+		chunk = (rlen > CDC_BUFSIZE) ? CDC_BUFSIZE : rlen;
+		w1_read(data, chunk);
+		if (cdc_send(tty, data, chunk) < 0)
+			return false;
+		rlen -= chunk;
+	}
+
+	return true;
+}
+
+/*
+ * Combined transaction (0x0D): reset, ROM command, data write, data read.
+ * Followed by the ROM command byte (plus an 8 byte ROM ID if it's Match
+ * ROM), the write length (0-255) and data, then the read length (0-255).
+ * We respond with a presence byte (0x01 if a device answered the reset)
+ * followed by the data read, so e.g. a Match ROM + Read Scratchpad is a
+ * single USB exchange.
+ *
+ * :return: False if the host disconnected, true otherwise
+ */
+static bool bpbin_w1_xfer(struct cdc *tty, uint8_t *buf, int *i, int *len)
+{
+	uint8_t data[CDC_BUFSIZE];
+	int c, chunk, n, pos, romlen, wlen, rlen;
+	bool present;
+
+	c = bpbin_next(tty, buf, i, len);
+	if (c < 0)
+		return false;
+
+	present = (w1_reset(false) == W1_PRESENT);
+	w1_write(c);
+
+	/* Clock everything out as it arrives */
+	romlen = (c == W1_MATCH_ROM) ? 8 : 0;
+	for (n = 0; n < romlen; n++) {
+		c = bpbin_next(tty, buf, i, len);
+		if (c < 0)
+			return false;
+		w1_write(c);
+	}
+
+	wlen = bpbin_next(tty, buf, i, len);
+	for (n = 0; wlen >= 0 && n < wlen; n++) {
+		c = bpbin_next(tty, buf, i, len);
+		if (c < 0)
+			return false;
+		w1_write(c);
+	}
+
+	rlen = bpbin_next(tty, buf, i, len);
+	if (wlen < 0 || rlen < 0)
+		return false;
+
+	data[0] = present;
+	pos = 1;
+	do {
+		chunk = sizeof(data) - pos;
+		if (chunk > rlen)
+			chunk = rlen;
+		w1_read(&data[pos], chunk);
+		rlen -= chunk;
+
+		if (cdc_send(tty, data, pos + chunk) < 0)
+			return false;
+		pos = 0;
+	} while (rlen > 0);
+
+	return true;
+}
+
 void bpbin_w1(struct cdc *tty, uint8_t *buf)
 {
-	int i, len;
+	int i, j, len;
 	bool found;
 	uint8_t resp;
+	uint8_t acks[16];
 	uint8_t devid[8];
 	struct w1_search_state search;
 
@@ -51,6 +180,12 @@ void bpbin_w1(struct cdc *tty, uint8_t *buf)
 				/* Read byte */
 				w1_read(&resp, 1);
 				cdc_send(tty, &resp, 1);
+			} else if (buf[i] == 5 || buf[i] == 6) {
+				/* Standard / overdrive speed */
+				w1_set_speed(buf[i] == 6 ?
+					W1_SPEED_OVERDRIVE :
+					W1_SPEED_STANDARD);
+				bpbin_ok(tty);
 			} else if (buf[i] == 8 || buf[i] == 9) {
 				/* ALARM / ROM search (0xEC / 0xF0) */
 				bpbin_ok(tty);
@@ -63,22 +198,40 @@ void bpbin_w1(struct cdc *tty, uint8_t *buf)
 				}
 				memset(devid, 0xFF, sizeof(devid));
 				cdc_send(tty, devid, sizeof(devid));
+			} else if (buf[i] == 0x0A) {
+				/* DS18B20 temperature survey */
+				bpbin_w1_survey(tty);
+			} else if (buf[i] == 0x0C) {
+				/* Bulk read */
+				if (!bpbin_w1_read(tty, buf, &i, &len))
+					return;
+			} else if (buf[i] == 0x0D) {
+				/* Reset + ROM command + write + read */
+				if (!bpbin_w1_xfer(tty, buf, &i, &len))
+					return;
 			} else if ((buf[i] & 0xF0) == 0x10) {
 				/* Send 1-16 bytes */
 				int left = (buf[i] & 0xF) + 1;
-				i++;
+
+				/*
+				 * Clock out everything we've already received
+				 * and return the acks in a single packet.
+				 */
 				while (left) {
-					if (i < len) {
-						w1_write(buf[i]);
-						bpbin_ok(tty);
-						left--;
-						i++;
-					} else {
+					if (i + 1 >= len) {
 						len = cdc_recv(tty, buf, NULL);
 						if (len < 0)
 							return;
-						i = 0;
+						i = -1;
+						continue;
+					}
+
+					for (j = 0; left && i + 1 < len; j++) {
+						w1_write(buf[++i]);
+						acks[j] = 1;
+						left--;
 					}
+					cdc_send(tty, acks, j);
 				}
 			} else if ((buf[i] & 0xF0) == 0x40) {
 				/* Configure peripheral pins */
@@ -10,6 +10,8 @@
 
 #include "cdc.h"
 #include "ccdbg.h"
+#include "ccflash.h"
+#include "crc.h"
 #include "debug.h"
 #include "gpio.h"
 
@@ -33,20 +35,67 @@
 #define CMD_INSTR_VER	0xF1
 #define CMD_INSTR_UPD	0xF2
 #define CMD_BURSTRD	0xF3
+/* Extensions */
+#define CMD_SET_CLOCK	0xF4
+#define CMD_AUTOTUNE	0xF5
+#define CMD_FLASH_PAGE	0xF6
+#define CMD_CAPS	0xF7
+#define CMD_CRC32	0xF8
+
+/*
+ * Capability bits for CMD_CAPS. The host sends the ones it wants enabled in
+ * cmd[1] and gets back the ones now in effect, so stock CCLib (which never
+ * sends CMD_CAPS) sees the original one response per command behaviour.
+ * Commands with a data phase (burst read/write, instruction table update,
+ * flash page) must be the last in a packet.
+ */
+#define CAP_BATCH	0x01	/* Coalesce responses to a packet of commands */
+#define CAP_STOP_ON_ERR	0x02	/* Skip rest of a packet after an error */
+#define CAP_ALL		(CAP_BATCH | CAP_STOP_ON_ERR)
 
 /* Response codes, as per CCLib */
 #define ANS_OK		1
 #define ANS_ERROR	2
 #define ANS_READY	3
 
+/* Avoid dynamic allocations */
+static struct ccproxy_batch {
+	uint8_t caps;
+	bool failed;
+	int len;
+	/* Multiple of the frame size, so a flush is never a full packet */
+	uint8_t resp[(CDC_BUFSIZE / 3) * 3];
+} ccproxy_batch;
+
+static void ccproxy_flush(struct cdc *tty)
+{
+	if (ccproxy_batch.len == 0)
+		return;
+
+	cdc_send(tty, ccproxy_batch.resp, ccproxy_batch.len);
+	ccproxy_batch.len = 0;
+}
+
 void ccproxy_sendframe(struct cdc *tty, uint8_t ans, uint8_t b0, uint8_t b1)
 {
-	uint8_t buf[3];
+	struct ccproxy_batch *batch = &ccproxy_batch;
+
+	if (ans == ANS_ERROR)
+		batch->failed = true;
 
-	buf[0] = ans;
-	buf[1] = b1;
-	buf[2] = b0;
-	cdc_send(tty, buf, 3);
+	if (batch->len + 3 > (int) sizeof(batch->resp))
+		ccproxy_flush(tty);
+
+	batch->resp[batch->len++] = ans;
+	batch->resp[batch->len++] = b1;
+	batch->resp[batch->len++] = b0;
+
+	/*
+	 * Send straight away unless batching; a ready response always goes
+	 * now as the host waits for it before starting the data phase.
+	 */
+	if (!(batch->caps & CAP_BATCH) || ans == ANS_READY)
+		ccproxy_flush(tty);
 }
 
 static void ccproxy_sendresp(struct cdc *tty, struct ccdbg_state *ctx,
@@ -61,11 +110,124 @@ static void ccproxy_sendresp(struct cdc *tty, struct ccdbg_state *ctx,
 		ccproxy_sendframe(tty, ANS_OK, b0, b1);
 }
 
+/*
+ * Burst read (CMD_BURSTRD) of XDATA from the current DPTR. Each packet is
+ * handed to the USB endpoint without waiting for it to go out, so the next
+ * packet is read from the target while the previous one is on the wire.
+ * After a debug error the rest of the data is sent as 0xFF; the final
+ * response frame reports the error.
+ */
+static void ccproxy_burstread(struct cdc *tty, struct ccdbg_state *ctx,
+		int left)
+{
+	uint8_t data[CDC_BUFSIZE];
+	int chunk, read;
+
+	while (left > 0) {
+		chunk = (left > CDC_BUFSIZE) ? CDC_BUFSIZE : left;
+
+		read = 0;
+		if (!ccdbg_error(ctx))
+			read = ccdbg_read_xdata_inc(ctx, data, chunk);
+		if (read < chunk)
+			memset(&data[read], 0xFF, chunk - read);
+
+		if (cdc_send_more(tty, data, chunk) < 0)
+			return;
+		left -= chunk;
+	}
+}
+
+/*
+ * CRC-32 of XDATA from the current DPTR (CMD_CRC32), for verifying flash
+ * through the XDATA bank window without reading it all back over USB.
+ * cmd[1..2] are the big endian length, and if bit 0 of cmd[3] is set we
+ * carry on from the previous CRC so the host can cover multiple banks. The
+ * reply is shaped like a burst read of 4 bytes: ANS_READY, the little
+ * endian CRC, then the status frame.
+ */
+static void ccproxy_crc32(struct cdc *tty, struct ccdbg_state *ctx,
+		uint8_t *cmd)
+{
+	static uint32_t crc;
+	uint8_t data[CDC_BUFSIZE];
+	int chunk, left;
+
+	if (!(cmd[3] & 1))
+		crc = 0;
+
+	left = cmd[1] << 8 | cmd[2];
+	while (left > 0 && !ccdbg_error(ctx)) {
+		chunk = (left > CDC_BUFSIZE) ? CDC_BUFSIZE : left;
+		chunk = ccdbg_read_xdata_inc(ctx, data, chunk);
+		crc = crc32(crc, data, chunk);
+		left -= chunk;
+	}
+
+	ccproxy_sendframe(tty, ANS_READY, 0, 0);
+	data[0] = crc & 0xFF;
+	data[1] = (crc >> 8) & 0xFF;
+	data[2] = (crc >> 16) & 0xFF;
+	data[3] = crc >> 24;
+	cdc_send(tty, data, 4);
+
+	ccproxy_sendresp(tty, ctx, 0, 0);
+}
+
+/*
+ * Flash page programming (CMD_FLASH_PAGE). cmd[1] bit 7 requests an erase
+ * first and bits 0-6 are the 2KB page number, cmd[2..3] the big endian data
+ * length (a multiple of 4, up to a full page). We reply ANS_READY, receive
+ * the data, then do the whole DMA sequence locally and reply with either
+ * ANS_OK and the CRC-16/ARC of the data received, or ANS_ERROR and the
+ * ccflash_status.
+ */
+static void ccproxy_flash_page(struct cdc *tty, struct ccdbg_state *ctx,
+		uint8_t *cmd)
+{
+	/* Avoid dynamic allocations */
+	static uint8_t page[CCFLASH_PAGE_SIZE + CDC_BUFSIZE];
+	enum ccflash_status status;
+	uint16_t crc;
+	int left, len, read;
+
+	len = cmd[2] << 8 | cmd[3];
+	if (len == 0 || len > CCFLASH_PAGE_SIZE || (len & 3)) {
+		ccproxy_sendframe(tty, ANS_ERROR, CCFLASH_RANGE, 0);
+		return;
+	}
+
+	ccproxy_sendframe(tty, ANS_READY, 0, 0);
+
+	left = len;
+	while (left > 0) {
+		read = cdc_recv(tty, &page[len - left], NULL);
+		if (read < 0)
+			return;
+		/* Any trailing excess lands in the slack after the page */
+		if (read > left)
+			read = left;
+		left -= read;
+	}
+
+	status = ccflash_write_page(ctx, cmd[1] & 0x7F, page, len,
+			cmd[1] & 0x80);
+	if (status != CCFLASH_OK) {
+		ccproxy_sendframe(tty, ANS_ERROR, status, 0);
+		return;
+	}
+
+	crc = crc16_arc(0, page, len);
+	ccproxy_sendframe(tty, ANS_OK, crc & 0xFF, crc >> 8);
+}
+
 static void ccproxy_handle_cmd(struct cdc *tty, struct ccdbg_state *ctx,
 		uint8_t *cmd)
 {
+	/* The command may be at the end of buf, so receive data separately */
+	uint8_t data[CDC_BUFSIZE];
 	uint8_t ret;
-	int left, read;
+	int left, read, ns;
 	uint16_t status;
 
 	switch (cmd[0]) {
@@ -147,11 +309,11 @@ static void ccproxy_handle_cmd(struct cdc *tty, struct ccdbg_state *ctx,
 		/* Read the next 16 bytes into our instruction table */
 		ret = 0;
 		left = CCDBG_INSTRLEN;
-		while (left > 0 && (read = cdc_recv(tty, cmd, NULL)) > 0) {
+		while (left > 0 && (read = cdc_recv(tty, data, NULL)) > 0) {
 			if (read > left)
 				read = left;
 
-			ret = ccdbg_updateinstr(ctx, cmd,
+			ret = ccdbg_updateinstr(ctx, data,
 					CCDBG_INSTRLEN - left, read);
 
 			left -= read;
@@ -181,14 +343,14 @@ static void ccproxy_handle_cmd(struct cdc *tty, struct ccdbg_state *ctx,
 		}
 
 		while (left > 0) {
-			read = cdc_recv(tty, cmd, NULL);
+			read = cdc_recv(tty, data, NULL);
 			if (read < 0)
 				return;
 			if (read > left)
 				read = left;
 
 			for (int i = 0; i < read; i++) {
-				if (!ccdbg_write(ctx, cmd[i])) {
+				if (!ccdbg_write(ctx, data[i])) {
 					ccproxy_sendresp(tty, ctx, 0, 0);
 					return;
 				}
@@ -201,33 +363,42 @@ static void ccproxy_handle_cmd(struct cdc *tty, struct ccdbg_state *ctx,
 		ccproxy_sendresp(tty, ctx, ret, 0);
 		break;
 	case CMD_BURSTRD:
-		left = cmd[1] << 8 | cmd[2];
-
-		if (left > 2048) {
-			ccproxy_sendframe(tty, ANS_ERROR, 3, 0);
-			return;
-		}
-
+		/* No 2048 byte cap; a whole 32KB XDATA flash bank is fine */
 		ccproxy_sendframe(tty, ANS_READY, 0, 0);
-
-		while (left > 0) {
-			read = (left > CDC_BUFSIZE) ? CDC_BUFSIZE : left;
-
-			for (int i = 0; i < read; i++) {
-				/* MOVX A, @DPTR */
-				cmd[i] = ccdbg_exec1(ctx, 0xE0);
-				/* INC DPTR */
-				ccdbg_exec1(ctx, 0xA3);
-			}
-
-			if (cdc_send(tty, cmd, read) < 0)
-				return;
-			left -= read;
-		}
+		ccproxy_burstread(tty, ctx, cmd[1] << 8 | cmd[2]);
 
 		ret = ccdbg_readcfg(ctx);
 		ccproxy_sendresp(tty, ctx, ret, 0);
 		break;
+	case CMD_SET_CLOCK:
+		/* Big endian DC half period in ns; returns the actual value */
+		status = ccdbg_set_clock(ctx, cmd[1] << 8 | cmd[2]);
+		ccproxy_sendframe(tty, ANS_OK, status & 0xFF,
+				(status >> 8) & 0xFF);
+		break;
+	case CMD_AUTOTUNE:
+		debug_print("CCProxy: AUTOTUNE\r\n");
+		ns = ccdbg_autotune(ctx);
+		if (ns < 0) {
+			/* Not wired */
+			ccproxy_sendframe(tty, ANS_ERROR, 3, 0);
+		} else {
+			ccproxy_sendframe(tty, ANS_OK, ns & 0xFF,
+					(ns >> 8) & 0xFF);
+		}
+		break;
+	case CMD_CAPS:
+		ccproxy_batch.caps = cmd[1] & CAP_ALL;
+		ccproxy_sendframe(tty, ANS_OK, ccproxy_batch.caps, CAP_ALL);
+		break;
+	case CMD_CRC32:
+		debug_print("CCProxy: CRC32\r\n");
+		ccproxy_crc32(tty, ctx, cmd);
+		break;
+	case CMD_FLASH_PAGE:
+		debug_print("CCProxy: FLASH PAGE\r\n");
+		ccproxy_flash_page(tty, ctx, cmd);
+		break;
 	default:
 		debug_print("CCProxy: Error\r\n");
 		ccproxy_sendframe(tty, ANS_ERROR, 0xFF, 0);
@@ -236,7 +407,8 @@ static void ccproxy_handle_cmd(struct cdc *tty, struct ccdbg_state *ctx,
 
 void ccproxy_main(struct cdc *tty, const uint8_t *s, int len)
 {
-	uint8_t buf[CDC_BUFSIZE];
+	/* Room for a partial command carried over plus a full packet */
+	uint8_t buf[CDC_BUFSIZE + 3];
 	int cur_len, i, ret;
 	struct ccdbg_state *ctx;
 
@@ -244,14 +416,26 @@ void ccproxy_main(struct cdc *tty, const uint8_t *s, int len)
 	cur_len = len;
 
 	ctx = ccdbg_init(PIN_AUX, PIN_CLK, PIN_MOSI);
+	ccproxy_batch.caps = 0;
+	ccproxy_batch.len = 0;
 
 	while (1) {
 		i = 0;
+		ccproxy_batch.failed = false;
 		while (cur_len >= 4) {
 			ccproxy_handle_cmd(tty, ctx, &buf[i]);
 			i += 4;
 			cur_len -= 4;
+
+			if (ccproxy_batch.failed &&
+					(ccproxy_batch.caps & CAP_STOP_ON_ERR)) {
+				/* Drop the rest of the batch */
+				cur_len = 0;
+				break;
+			}
 		}
+		ccproxy_flush(tty);
+
 		/*
 		 * Cope with the situation where we get a full command and part
 		 * of the next one. Should be unlikely; we expect a single full
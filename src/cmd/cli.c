@@ -16,6 +16,8 @@
 #include "board.h"
 #include "cdc.h"
 #include "debug.h"
+#include "dwt.h"
+#include "freq.h"
 #include "gpio.h"
 #include "tty.h"
 #include "version.h"
@@ -90,6 +92,17 @@ static bool cli_aux_set(struct cli_state *state, bool on)
 	return true;
 }
 
+static bool cli_freq(struct cli_state *state, unsigned int gate)
+{
+	if (gate > FREQ_MAX_GATE_MS) {
+		tty_printf(state->tty, "Gate time too long\r\n");
+		return false;
+	}
+	cli_dio_freq(state, gate);
+
+	return true;
+}
+
 static bool cli_banner(struct cli_state *state)
 {
 	tty_printf(state->tty, "DeskViking " VER_STRING "\r\n");
@@ -108,10 +121,10 @@ static bool cli_delay(struct cli_state *state, bool ms, unsigned int repeat)
 	tty_printdec(state->tty, repeat);
 	if (ms) {
 		tty_printf(state->tty, "ms\r\n");
-		chopstx_usec_wait(1000 * repeat);
+		dwt_sleep(1000 * repeat);
 	} else {
 		tty_printf(state->tty, "µs\r\n");
-		chopstx_usec_wait(repeat);
+		dwt_sleep(repeat);
 	}
 
 	return true;
@@ -131,8 +144,10 @@ static bool cli_help(struct cli_state *state)
 				"123\r\n");
 	tty_printf(state->tty, " a/A/@  Set AUX low/HI/read value     "
 				"0x123  Send value\r\n");
-	tty_printf(state->tty, " i      Version/status info           "
+	tty_printf(state->tty, " f      Measure AUX frequency, f:ms   "
 				"r      Read\r\n");
+	tty_printf(state->tty, " i      Version/status info           "
+				"\r\n");
 	tty_printf(state->tty, " m      Change mode                   "
 				":      Repeat e.g. r:8\r\n");
 	tty_printf(state->tty, " v      Show volts/states             "
@@ -423,6 +438,13 @@ static void cli_process_cmd(struct cli_state *state, const char *cmd, unsigned i
 		case 'A':
 			ok = cli_aux_set(state, true);
 			break;
+		case 'f':
+			/* No gate time given, so default to a second */
+			repeat = 1000;
+			if (len > 0 && *cmd == ':')
+				repeat = cli_parse_repeat(&cmd, &len);
+			ok = cli_freq(state, repeat);
+			break;
 		case 'i':
 			ok = cli_banner(state);
 			break;
@@ -29,6 +29,7 @@ struct cli_state {
 /* In cli_dio.c */
 void cli_dio_read(struct cli_state *state);
 void cli_dio_write(struct cli_state *state, uint8_t val);
+void cli_dio_freq(struct cli_state *state, unsigned int gate);
 
 /* In cli_i2c.c */
 void cli_i2c_setup(struct cli_state *state);
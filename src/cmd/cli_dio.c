@@ -6,6 +6,7 @@
  */
 
 #include "buspirate.h"
+#include "freq.h"
 #include "tty.h"
 
 #include "cli.h"
@@ -26,3 +27,104 @@ void cli_dio_write(struct cli_state *state, uint8_t val)
 		bp_set_direction(val);
 	}
 }
+
+/* Prints a fixed point value with the given number of decimal places */
+static void cli_dio_printfixed(struct cli_state *state, uint32_t val,
+		int places)
+{
+	uint32_t div = 1;
+	uint32_t frac;
+	int i;
+
+	for (i = 0; i < places; i++)
+		div *= 10;
+
+	tty_printudec(state->tty, val / div);
+	tty_putc(state->tty, '.');
+	frac = val % div;
+	for (i = places - 1; i >= 0; i--) {
+		div /= 10;
+		tty_putc(state->tty, '0' + (frac / div) % 10);
+	}
+}
+
+/* Prints a DWT cycle count as µs, to 2 decimal places */
+static void cli_dio_printus(struct cli_state *state, uint32_t cycles)
+{
+	cli_dio_printfixed(state, (uint64_t) cycles * 100 / MHZ, 2);
+	tty_printf(state->tty, "µs");
+}
+
+static void cli_dio_print_pulses(struct cli_state *state, const char *name,
+		const struct freq_pulses *p)
+{
+	tty_printf(state->tty, name);
+	if (p->count == 0) {
+		tty_printf(state->tty, "none\r\n");
+		return;
+	}
+	tty_printf(state->tty, "avg ");
+	cli_dio_printus(state, p->sum / p->count);
+	tty_printf(state->tty, ", min ");
+	cli_dio_printus(state, p->min);
+	tty_printf(state->tty, ", max ");
+	cli_dio_printus(state, p->max);
+	tty_printf(state->tty, " (");
+	tty_printudec(state->tty, p->count);
+	tty_printf(state->tty, ")\r\n");
+}
+
+/**
+ * Measures the signal on AUX and prints the frequency, duty cycle and pulse
+ * width statistics.
+ *
+ * :param gate: Gate time in ms
+ */
+void cli_dio_freq(struct cli_state *state, unsigned int gate)
+{
+	struct freq_result res;
+	int i;
+
+	tty_printf(state->tty, "AUX INPUT/HI-Z, MEASURING FOR ");
+	tty_printudec(state->tty, gate);
+	tty_printf(state->tty, "ms\r\n");
+
+	freq_measure(gate, &res);
+
+	if (res.edges == 0) {
+		tty_printf(state->tty, "No edges seen\r\n");
+		return;
+	}
+
+	tty_printf(state->tty, "Frequency: ");
+	cli_dio_printfixed(state, freq_millihz(&res), 3);
+	tty_printf(state->tty, "Hz, duty cycle: ");
+	cli_dio_printfixed(state, freq_duty_permille(&res), 1);
+	tty_printf(state->tty, "%\r\n");
+	cli_dio_print_pulses(state, "Period: ", &res.period);
+	cli_dio_print_pulses(state, "High:   ", &res.high);
+	cli_dio_print_pulses(state, "Low:    ", &res.low);
+	if (res.missed) {
+		tty_printf(state->tty, "Signal too fast, missed edges ");
+		tty_printudec(state->tty, res.missed);
+		tty_printf(state->tty, " times\r\n");
+	}
+
+	tty_printf(state->tty, "Width\t\tHigh\tLow\r\n");
+	for (i = 0; i < FREQ_HIST_BINS; i++) {
+		if (res.high.hist[i] == 0 && res.low.hist[i] == 0)
+			continue;
+		if (i == 0) {
+			tty_printf(state->tty, "<1µs");
+		} else {
+			tty_printf(state->tty, ">=");
+			tty_printudec(state->tty, 1 << (i - 1));
+			tty_printf(state->tty, "µs");
+		}
+		tty_printf(state->tty, "\t\t");
+		tty_printudec(state->tty, res.high.hist[i]);
+		tty_putc(state->tty, '\t');
+		tty_printudec(state->tty, res.low.hist[i]);
+		tty_printf(state->tty, "\r\n");
+	}
+}
@@ -4,6 +4,11 @@
  *
  * Copyright 2020 Jonathan McDowell <noodles@earth.li>
  */
+#include <stdlib.h>
+#include <string.h>
+
+#include "crc.h"
+#include "eeprom.h"
 #include "gpio.h"
 #include "i2c.h"
 #include "tty.h"
@@ -11,10 +16,21 @@
 #include "cli.h"
 #include "util.h"
 
+/* Default 7-bit address used for 24Cxx EEPROMs */
+#define EEPROM_ADDR	0x50
+
 struct i2c_state {
 	bool ackpending;
 };
 
+static const char *eeprom_status_str[] = {
+	[EEPROM_OK] = "OK",
+	[EEPROM_NACK] = "NACK from device",
+	[EEPROM_TIMEOUT] = "timeout waiting for write",
+	[EEPROM_VERIFY_FAIL] = "verify failed",
+	[EEPROM_RANGE] = "out of range",
+};
+
 void cli_i2c_setup(struct cli_state *state)
 {
 	struct i2c_state *ctx = (struct i2c_state *) state->priv;
@@ -48,14 +64,17 @@ void cli_i2c_stop(struct cli_state *state)
 void cli_i2c_read(struct cli_state *state)
 {
 	struct i2c_state *ctx = (struct i2c_state *) state->priv;
+	uint8_t val;
 
 	if (ctx->ackpending) {
 		i2c_write_bit(false);
 		tty_printf(state->tty, " ACK");
 	}
 
+	/* We don't know if we should ACK or NACK until the next command */
+	i2c_read_buf(&val, 1, I2C_ACK_DEFER);
 	tty_putc(state->tty, ' ');
-	tty_printhex(state->tty, i2c_read(), 2);
+	tty_printhex(state->tty, val, 2);
 	ctx->ackpending = true;
 }
 
@@ -63,47 +82,251 @@ void cli_i2c_write(struct cli_state *state, uint8_t val)
 {
 	tty_putc(state->tty, ' ');
 	tty_printhex(state->tty, val, 2);
-	tty_printf(state->tty, i2c_write(val) ? " NACK" : " ACK");
+	tty_printf(state->tty, i2c_write_buf(&val, 1, false) ? " ACK" : " NACK");
+}
+
+/*
+ * Renders the results of an i2c_scan() as an i2cdetect style table. The
+ * whole table is built up and sent in one go rather than piecemeal.
+ */
+static void cli_i2c_print_scan(struct cli_state *state,
+		const uint8_t bitmap[16])
+{
+	static const char header[] =
+		"      0  1  2  3  4  5  6  7  8  9  a  b  c  d  e  f\r\n";
+	/* Header + 8 rows of "xx: " + 16 * " xx" + "\r\n" */
+	static char buf[sizeof(header) - 1 + 8 * (4 + 16 * 3 + 2)];
+	int addr, pos;
+
+	memcpy(buf, header, sizeof(header) - 1);
+	pos = sizeof(header) - 1;
+
+	for (addr = 0; addr < 128; addr++) {
+		if ((addr & 0xF) == 0) {
+			buf[pos++] = util_hexchar(addr >> 4);
+			buf[pos++] = '0';
+			buf[pos++] = ':';
+			buf[pos++] = ' ';
+		}
+
+		buf[pos++] = ' ';
+		if (bitmap[addr >> 3] & (1 << (addr & 7))) {
+			buf[pos++] = util_hexchar(addr >> 4);
+			buf[pos++] = util_hexchar(addr & 0xF);
+		} else {
+			buf[pos++] = '-';
+			buf[pos++] = '-';
+		}
+
+		if ((addr & 0xF) == 0xF) {
+			buf[pos++] = '\r';
+			buf[pos++] = '\n';
+		}
+	}
+
+	cdc_send(state->tty, (uint8_t *) buf, pos);
 }
 
-static void cli_i2c_scan(struct cli_state *state)
+static void cli_i2c_scan(struct cli_state *state, enum i2c_scan_mode mode,
+		uint8_t speed)
 {
-	int i, j;
-	char buf[5];
+	uint8_t bitmap[16];
 
 	if (!i2c_pullups_ok()) {
 		tty_printf(state->tty, "short or no-pullup\r\n");
 		return;
 	}
 
-	tty_printf(state->tty,
-		"      0  1  2  3  4  5  6  7  8  9  a  b  c  d  e  f\r\n");
-
-	for (i = 0; i < 128; i += 16) {
-		buf[0] = util_hexchar(i >> 4);
-		buf[1] = util_hexchar(i & 0xF);
-		buf[2] = ':';
-		buf[3] = ' ';
-		buf[4] = 0;
-		tty_printf(state->tty, buf);
-
-		buf[0] = ' ';
-		buf[1] = util_hexchar(i >> 4);
-		buf[3] = 0;
-		for (j = 0; j < 16; j++) {
-			i2c_start();
-			if (i2c_write((i + j) << 1)) {
-				tty_printf(state->tty, " --");
-			} else {
-				buf[2] = util_hexchar(j);
-				tty_printf(state->tty, buf);
+	i2c_set_speed(speed);
+	i2c_scan(bitmap, mode);
+	i2c_set_speed(I2C_SPEED_100KHZ);
+
+	cli_i2c_print_scan(state, bitmap);
+}
+
+static const struct eeprom_type *cli_i2c_eeprom_type(struct cli_state *state)
+{
+	char opt[3];
+	unsigned long choice;
+	int i, len;
+
+	for (i = 0; i < EEPROM_TYPE_COUNT; i++) {
+		tty_printdec(state->tty, i + 1);
+		tty_printf(state->tty, ". ");
+		tty_printf(state->tty, eeprom_types[i].name);
+		tty_printf(state->tty, "\r\n");
+	}
+
+	while (true) {
+		tty_printf(state->tty, "EEPROM type>");
+		len = tty_readline(state->tty, opt, sizeof(opt));
+		if (len < 0 || (len > 0 && (opt[0] == 'x' || opt[0] == 'X')))
+			return NULL;
+
+		opt[len] = 0;
+		choice = strtoul(opt, NULL, 10);
+		if (choice >= 1 && choice <= EEPROM_TYPE_COUNT)
+			return &eeprom_types[choice - 1];
+
+		tty_printf(state->tty, "Invalid choice, try again.\r\n");
+	}
+}
+
+static void cli_i2c_eeprom_result(struct cli_state *state,
+		enum eeprom_status status, uint16_t crc)
+{
+	tty_printf(state->tty, "EEPROM ");
+	tty_printf(state->tty, eeprom_status_str[status]);
+	if (status == EEPROM_OK) {
+		tty_printf(state->tty, ", CRC16 ");
+		tty_printhex(state->tty, crc, 4);
+	}
+	tty_printf(state->tty, "\r\n");
+}
+
+/*
+ * Dumps (if print is set) or just checksums the entire EEPROM.
+ */
+static void cli_i2c_eeprom_read(struct cli_state *state, bool print)
+{
+	const struct eeprom_type *type;
+	enum eeprom_status status;
+	uint8_t data[16];
+	/* "xxxxx:" + 16 * " xx" + "\r\n" */
+	char line[6 + 16 * 3 + 2];
+	uint32_t ofs;
+	uint16_t crc;
+	int i, pos;
+
+	type = cli_i2c_eeprom_type(state);
+	if (!type)
+		return;
+
+	crc = 0;
+	status = EEPROM_OK;
+	for (ofs = 0; ofs < type->size; ofs += sizeof(data)) {
+		status = eeprom_read(type, EEPROM_ADDR, ofs, data,
+				sizeof(data));
+		if (status != EEPROM_OK)
+			break;
+		crc = crc16_arc(crc, data, sizeof(data));
+
+		if (!print)
+			continue;
+
+		pos = 0;
+		for (i = 16; i >= 0; i -= 4)
+			line[pos++] = util_hexchar(ofs >> i);
+		line[pos++] = ':';
+		for (i = 0; i < (int) sizeof(data); i++) {
+			line[pos++] = ' ';
+			line[pos++] = util_hexchar(data[i] >> 4);
+			line[pos++] = util_hexchar(data[i]);
+		}
+		line[pos++] = '\r';
+		line[pos++] = '\n';
+		cdc_send(state->tty, (uint8_t *) line, pos);
+	}
+
+	cli_i2c_eeprom_result(state, status, crc);
+}
+
+/*
+ * Erases the entire EEPROM to 0xFF using page writes, verifying as we go.
+ */
+static void cli_i2c_eeprom_erase(struct cli_state *state)
+{
+	const struct eeprom_type *type;
+	struct eeprom_prog *prog;
+	enum eeprom_status status;
+	uint8_t blank[32];
+	uint32_t ofs;
+	uint16_t crc;
+
+	type = cli_i2c_eeprom_type(state);
+	if (!type)
+		return;
+
+	memset(blank, 0xFF, sizeof(blank));
+	prog = eeprom_prog_start(type, EEPROM_ADDR, 0, type->size);
+	for (ofs = 0; ofs < type->size; ofs += sizeof(blank)) {
+		if (eeprom_prog_data(prog, blank, sizeof(blank)) != EEPROM_OK)
+			break;
+	}
+	status = eeprom_prog_finish(prog, &crc);
+
+	cli_i2c_eeprom_result(state, status, crc);
+}
+
+/*
+ * Passive bus monitor; prints traffic in Bus Pirate sniffer style until a
+ * key is pressed. If trigger is set only shows traffic from the first
+ * transaction to a given 7-bit address onwards.
+ */
+static void cli_i2c_monitor(struct cli_state *state, bool trigger)
+{
+	static uint8_t records[64 * I2C_MON_RECLEN];
+	uint8_t buf[CDC_BUFSIZE];
+	unsigned long addr;
+	uint32_t timeout;
+	int i, len;
+
+	addr = 0;
+	while (trigger) {
+		tty_printf(state->tty, "7-bit address (hex)>");
+		len = tty_readline(state->tty, (char *) buf, 3);
+		if (len < 0 || (len > 0 && (buf[0] == 'x' || buf[0] == 'X')))
+			return;
+
+		buf[len] = 0;
+		addr = strtoul((char *) buf, NULL, 16);
+		if (len > 0 && addr <= 0x7F)
+			break;
+
+		tty_printf(state->tty, "Invalid address, try again.\r\n");
+	}
+
+	tty_printf(state->tty, "Monitoring I2C bus, any key to exit\r\n");
+
+	i2c_monitor_start();
+	if (trigger)
+		i2c_monitor_trigger(addr << 1, 0xFE);
+	while (1) {
+		len = i2c_monitor_capture(records, sizeof(records), 10000);
+		for (i = 0; i < len; i += I2C_MON_RECLEN) {
+			switch (records[i]) {
+			case I2C_MON_START:
+				tty_putc(state->tty, '[');
+				break;
+			case I2C_MON_STOP:
+				tty_printf(state->tty, "]\r\n");
+				break;
+			case I2C_MON_ACK:
+			case I2C_MON_NACK:
+				tty_printhex(state->tty, records[i + 1], 2);
+				tty_putc(state->tty,
+					records[i] == I2C_MON_ACK ? '+' : '-');
+				break;
+			case I2C_MON_RESYNC:
+				tty_printf(state->tty, "<resync>");
+				break;
+			case I2C_MON_OVERFLOW:
+				tty_printf(state->tty, "<overflow>");
+				break;
 			}
-			i2c_write_bit(true);
-			i2c_stop();
 		}
 
-		tty_printf(state->tty, "\r\n");
+		timeout = 0;
+		len = cdc_recv(state->tty, buf, &timeout);
+		if (len != 0)
+			break;
 	}
+
+	tty_printf(state->tty, "\r\nDropped records: ");
+	tty_printudec(state->tty, i2c_monitor_dropped());
+	tty_printf(state->tty, "\r\n");
+
+	i2c_init(PIN_CLK, PIN_MOSI);
 }
 
 bool cli_i2c_run_macro(struct cli_state *state, unsigned char macro)
@@ -113,10 +336,45 @@ bool cli_i2c_run_macro(struct cli_state *state, unsigned char macro)
 		tty_printf(state->tty, "  0. Macro menu\r\n");
 		tty_printf(state->tty,
 			"  1. 7-bit address search\r\n");
+		tty_printf(state->tty,
+			"  2. 7-bit address search, 400kHz\r\n");
+		tty_printf(state->tty,
+			"  3. 7-bit address search, read probes only\r\n");
+		tty_printf(state->tty,
+			"  4. 24Cxx EEPROM dump (at 0x50)\r\n");
+		tty_printf(state->tty,
+			"  5. 24Cxx EEPROM CRC16 (at 0x50)\r\n");
+		tty_printf(state->tty,
+			"  6. 24Cxx EEPROM erase + verify (at 0x50)\r\n");
+		tty_printf(state->tty,
+			"  7. Passive bus monitor\r\n");
+		tty_printf(state->tty,
+			"  8. Passive bus monitor, trigger on address\r\n");
 		break;
 	case 1:
 		tty_printf(state->tty, "Searching I2C address space:\r\n");
-		cli_i2c_scan(state);
+		cli_i2c_scan(state, I2C_SCAN_AUTO, I2C_SPEED_100KHZ);
+		break;
+	case 2:
+		tty_printf(state->tty, "Searching I2C address space:\r\n");
+		cli_i2c_scan(state, I2C_SCAN_AUTO, I2C_SPEED_400KHZ);
+		break;
+	case 3:
+		tty_printf(state->tty, "Searching I2C address space:\r\n");
+		cli_i2c_scan(state, I2C_SCAN_READ, I2C_SPEED_100KHZ);
+		break;
+	case 4:
+		cli_i2c_eeprom_read(state, true);
+		break;
+	case 5:
+		cli_i2c_eeprom_read(state, false);
+		break;
+	case 6:
+		cli_i2c_eeprom_erase(state);
+		break;
+	case 7:
+	case 8:
+		cli_i2c_monitor(state, macro == 8);
 		break;
 	default:
 		tty_printf(state->tty, "Unknown macro, try ? or (0) for help\r\n");
@@ -4,6 +4,7 @@
  *
  * Copyright 2020 Jonathan McDowell <noodles@earth.li>
  */
+#include "ds18b20.h"
 #include "gpio.h"
 #include "tty.h"
 #include "w1.h"
@@ -47,7 +48,8 @@ void cli_w1_write(struct cli_state *state, uint8_t val)
 	w1_write(val);
 }
 
-static void cli_w1_print_devid(struct cli_state *state, uint8_t devid[8])
+static void cli_w1_print_devid(struct cli_state *state,
+		const uint8_t devid[8])
 {
 	int i;
 
@@ -58,9 +60,111 @@ static void cli_w1_print_devid(struct cli_state *state, uint8_t devid[8])
 	}
 }
 
+/*
+ * Lists the cached device set, marking devices that appeared or went away
+ * on the last scan.
+ */
+static void cli_w1_print_devlist(struct cli_state *state,
+		const struct w1_devlist *list)
+{
+	int i;
+
+	for (i = 0; i < list->count; i++) {
+		if (list->dev[i].flags & W1_DEV_NEW)
+			tty_printf(state->tty, " + ");
+		else if (list->dev[i].flags & W1_DEV_GONE)
+			tty_printf(state->tty, " - ");
+		else
+			tty_printf(state->tty, "   ");
+		cli_w1_print_devid(state, list->dev[i].devid);
+		tty_printf(state->tty, "\r\n");
+	}
+
+	if (list->overflow)
+		tty_printf(state->tty, "Too many devices, list truncated\r\n");
+}
+
+/*
+ * Searches for devices on a separate bus on each of the pins at once,
+ * then goes back to the single bus on MOSI.
+ */
+static void cli_w1_multi_search(struct cli_state *state)
+{
+	static const uint8_t pins[] = {
+		PIN_MOSI, PIN_CLK, PIN_MISO, PIN_CS, PIN_AUX,
+	};
+	static const char *names[] = {
+		"MOSI", "CLK ", "MISO", "CS  ", "AUX ",
+	};
+	struct w1_multi_search_state search;
+	uint8_t devid[W1_MULTI_MAX][8];
+	uint8_t found;
+	int i;
+
+	if (!w1_multi_init(pins, sizeof(pins))) {
+		tty_printf(state->tty, "Pins not on a single port\r\n");
+		return;
+	}
+
+	tty_printf(state->tty, "Pin   1-Wire address\r\n");
+	found = w1_multi_find_first(W1_ROM_SEARCH, &search, devid);
+	while (found) {
+		for (i = 0; i < (int) sizeof(pins); i++) {
+			if (!(found & (1 << i)))
+				continue;
+			tty_printf(state->tty, names[i]);
+			tty_printf(state->tty, "  ");
+			cli_w1_print_devid(state, devid[i]);
+			tty_printf(state->tty, "\r\n");
+		}
+		found = w1_multi_find_next(&search, devid);
+	}
+
+	w1_init(PIN_MOSI);
+}
+
+/*
+ * Converts and reads every temperature sensor on the bus, printing each
+ * reading in °C.
+ */
+static void cli_w1_survey(struct cli_state *state)
+{
+	struct ds18b20_survey survey;
+	struct ds18b20_reading reading;
+	int temp;
+	bool found;
+
+	tty_printf(state->tty, "1-Wire address            Temperature\r\n");
+
+	found = ds18b20_survey_first(&survey, &reading);
+	if (found && !survey.converted)
+		tty_printf(state->tty, "Conversion timed out\r\n");
+
+	while (found) {
+		cli_w1_print_devid(state, reading.devid);
+		tty_printf(state->tty, "  ");
+		if (reading.status & DS18B20_CRC_BAD) {
+			tty_printf(state->tty, "CRC error\r\n");
+		} else {
+			temp = reading.temp;
+			if (temp < 0) {
+				tty_putc(state->tty, '-');
+				temp = -temp;
+			}
+			tty_printdec(state->tty, temp >> 4);
+			tty_putc(state->tty, '.');
+			tty_printdec(state->tty, ((temp & 0xF) * 10) >> 4);
+			tty_printf(state->tty, " C\r\n");
+		}
+
+		found = ds18b20_survey_next(&survey, &reading);
+	}
+}
+
 bool cli_w1_run_macro(struct cli_state *state, unsigned char macro)
 {
 	struct w1_search_state search;
+	struct w1_stats stats;
 	uint8_t devid[8];
 	bool found;
 	int i;
@@ -68,13 +172,57 @@ bool cli_w1_run_macro(struct cli_state *state, unsigned char macro)
 	switch (macro) {
 	case 0:
 		tty_printf(state->tty, "  0. Macro menu\r\n");
+		tty_printf(state->tty,
+			"  1. Return to standard speed\r\n");
+		tty_printf(state->tty,
+			"  2. Slot timing overrun counters\r\n");
+		tty_printf(state->tty,
+			"  3. ROM SEARCH, caching devices found\r\n");
+		tty_printf(state->tty,
+			"  4. Quick rescan for changes\r\n");
+		tty_printf(state->tty,
+			"  5. Full rescan for changes\r\n");
+		tty_printf(state->tty,
+			"  6. ROM SEARCH on all pins in parallel\r\n");
+		tty_printf(state->tty,
+			"  7. DS18B20 temperature survey\r\n");
 		tty_printf(state->tty,
 			" 51. READ ROM (0x33) *for single device bus\r\n");
+		tty_printf(state->tty,
+			" 60. OVERDRIVE SKIP ROM (0x3C)\r\n");
 		tty_printf(state->tty,
 			"236. ALARM SEARCH (0xEC)\r\n");
 		tty_printf(state->tty,
 			"240. ROM SEARCH (0xF0)\r\n");
 		break;
+	case 1:
+		w1_set_speed(W1_SPEED_STANDARD);
+		tty_printf(state->tty, "STANDARD SPEED\r\n");
+		cli_w1_start(state);
+		break;
+	case 2:
+		w1_get_stats(&stats, true);
+		tty_printf(state->tty, "Overruns: write ");
+		tty_printudec(state->tty, stats.write_overruns);
+		tty_printf(state->tty, ", read ");
+		tty_printudec(state->tty, stats.read_overruns);
+		tty_printf(state->tty, ", reset ");
+		tty_printudec(state->tty, stats.reset_overruns);
+		tty_printf(state->tty, "\r\n");
+		break;
+	case 3:
+		cli_w1_print_devlist(state, w1_scan(W1_ROM_SEARCH));
+		break;
+	case 4:
+	case 5:
+		cli_w1_print_devlist(state, w1_rescan(macro == 5));
+		break;
+	case 6:
+		cli_w1_multi_search(state);
+		break;
+	case 7:
+		cli_w1_survey(state);
+		break;
 	case 51:
 		cli_w1_start(state);
 		tty_printf(state->tty, "READ ROM (0x33): ");
@@ -85,6 +233,13 @@ bool cli_w1_run_macro(struct cli_state *state, unsigned char macro)
 		cli_w1_print_devid(state, devid);
 		tty_printf(state->tty, "\r\n");
 		break;
+	case W1_OD_SKIP_ROM:
+		tty_printf(state->tty, "OVERDRIVE SKIP ROM (0x3C): ");
+		if (w1_overdrive_skip() == W1_PRESENT)
+			tty_printf(state->tty, "overdrive speed\r\n");
+		else
+			tty_printf(state->tty, "no device detected\r\n");
+		break;
 	case W1_ALARM_SEARCH:
 	case W1_ROM_SEARCH:
 		tty_printf(state->tty, "SEARCH (");
@@ -0,0 +1,309 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ * SUMP / Openbench Logic Sniffer compatible logic analyser mode
+ *
+ * http://dangerousprototypes.com/docs/The_Logic_Sniffer%27s_extended_SUMP_protocol
+ *
+ * Copyright 2021 Jonathan McDowell <noodles@earth.li>
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "cdc.h"
+#include "debug.h"
+#include "gpio.h"
+#include "la.h"
+
+/* Short commands */
+#define SUMP_RESET	0x00
+#define SUMP_RUN	0x01
+#define SUMP_ID		0x02
+#define SUMP_METADATA	0x04
+#define SUMP_XON	0x11
+#define SUMP_XOFF	0x13
+
+/* Long commands; followed by 4 bytes of little endian data */
+#define SUMP_DIVIDER	0x80
+#define SUMP_CNT	0x81
+#define SUMP_FLAGS	0x82
+/* Trigger stage n commands are these + 4 * n */
+#define SUMP_TRIG_MASK	0xC0
+#define SUMP_TRIG_VAL	0xC1
+#define SUMP_TRIG_CFG	0xC2
+#define SUMP_STAGES	4
+/*
+ * Extension: protocol trigger, overriding the SUMP stages. Data byte 0 is
+ * a SUMP_PROTO_* type, the rest type specific.
+ */
+#define SUMP_PROTO_TRIG	0xA0
+
+/* Trigger stage configuration: level the stage is armed at */
+#define SUMP_TRIG_LEVEL(cfg)	(((cfg) >> 16) & 3)
+/* Trigger stage configuration: stage starts capture when matched */
+#define SUMP_TRIG_START	(1UL << 27)
+
+/* Protocol trigger types */
+#define SUMP_PROTO_NONE		0
+/*
+ * I2C address byte (byte 1) on CLK (SCL) / MOSI (SDA), matching the bits in
+ * byte 2 (0 for all of them)
+ */
+#define SUMP_PROTO_I2C_ADDR	1
+/* 1-Wire reset pulse on MOSI */
+#define SUMP_PROTO_W1_RESET	2
+/* Edge on the channels in byte 1; rising if byte 2 is non-zero */
+#define SUMP_PROTO_EDGE		3
+
+/* Shortest low pulse we count as a 1-Wire reset, in µs */
+#define SUMP_W1_RESET_US	480
+
+/* Sample rates are expressed as a divider of this clock */
+#define SUMP_CLOCK	100000000
+
+/* Avoid dynamic allocations */
+static struct sump_state {
+	uint32_t divider;
+	uint32_t read;
+	uint32_t delay;
+	uint32_t flags;
+	uint32_t trig_mask[SUMP_STAGES];
+	uint32_t trig_value[SUMP_STAGES];
+	uint32_t trig_cfg[SUMP_STAGES];
+	uint32_t proto;
+	struct trigger trig;
+} sump_state;
+
+static void sump_reset(struct sump_state *sump)
+{
+	memset(sump, 0, sizeof(*sump));
+	sump->divider = SUMP_CLOCK / 1000000 - 1;
+	sump->read = 4096;
+	sump->delay = 4096;
+}
+
+static int sump_meta_u32(uint8_t *buf, uint8_t key, uint32_t val)
+{
+	buf[0] = key;
+	buf[1] = val >> 24;
+	buf[2] = (val >> 16) & 0xFF;
+	buf[3] = (val >> 8) & 0xFF;
+	buf[4] = val & 0xFF;
+
+	return 5;
+}
+
+static void sump_metadata(struct cdc *tty)
+{
+	uint8_t buf[CDC_BUFSIZE];
+	int len;
+
+	len = 0;
+	buf[len++] = 0x01;
+	memcpy(&buf[len], "Desk Viking", 12);
+	len += 12;
+	len += sump_meta_u32(&buf[len], 0x20, LA_CHANNELS);
+	len += sump_meta_u32(&buf[len], 0x21, la_max_samples());
+	len += sump_meta_u32(&buf[len], 0x23, LA_MAX_RATE);
+	len += sump_meta_u32(&buf[len], 0x24, 2);
+	buf[len++] = 0x00;
+
+	cdc_send(tty, buf, len);
+}
+
+/*
+ * Builds the trigger from the SUMP stages, walking them in level order as
+ * each level's match arms the next, until one that starts the capture; or
+ * from our protocol trigger extension if one is set.
+ *
+ * :return: The trigger, or NULL to start capturing straight away
+ */
+static struct trigger *sump_trigger(struct sump_state *sump, uint32_t rate)
+{
+	struct trigger *t = &sump->trig;
+	uint64_t count;
+	uint32_t level;
+	uint8_t mask;
+	int i;
+
+	trigger_init(t);
+
+	switch (sump->proto & 0xFF) {
+	case SUMP_PROTO_I2C_ADDR:
+		mask = (sump->proto >> 16) & 0xFF;
+		trigger_add_i2c_addr(t, LA_CH_CLK, LA_CH_MOSI,
+				(sump->proto >> 8) & 0xFF, mask ? mask : 0xFF);
+		return t;
+	case SUMP_PROTO_W1_RESET:
+		count = (uint64_t) rate * SUMP_W1_RESET_US / 1000000;
+		trigger_add_w1_reset(t, LA_CH_MOSI, count ? count : 1);
+		return t;
+	case SUMP_PROTO_EDGE:
+		trigger_add_edge(t, (sump->proto >> 8) & 0xFF,
+				(sump->proto >> 16) & 0xFF);
+		return t;
+	}
+
+	for (level = 0; level < SUMP_STAGES; level++) {
+		for (i = 0; i < SUMP_STAGES; i++)
+			if (sump->trig_mask[i] &&
+				SUMP_TRIG_LEVEL(sump->trig_cfg[i]) == level)
+				break;
+		if (i == SUMP_STAGES)
+			break;
+
+		trigger_add_pattern(t, sump->trig_mask[i],
+				sump->trig_value[i], 1);
+		if (sump->trig_cfg[i] & SUMP_TRIG_START)
+			break;
+	}
+
+	return t->stages ? t : NULL;
+}
+
+/*
+ * Runs a capture, sending the samples back newest first as the protocol
+ * requires, one byte per enabled channel group. We only have one group's
+ * worth of channels; any others read as 0.
+ *
+ * :return: False if the host disconnected, true otherwise
+ */
+static bool sump_run(struct cdc *tty, struct sump_state *sump)
+{
+	struct la_config cfg;
+	uint8_t buf[CDC_BUFSIZE];
+	uint32_t block, i, timeout;
+	int groups, len, g;
+
+	cfg.rate = SUMP_CLOCK / (sump->divider + 1);
+	cfg.samples = sump->read;
+	cfg.post = sump->delay;
+	cfg.trig = sump_trigger(sump, cfg.rate);
+
+	/* Flag bits 2-5 disable channel groups 0-3 */
+	groups = 0;
+	for (g = 0; g < 4; g++)
+		if (!(sump->flags & (1 << (g + 2))))
+			groups++;
+
+	/* Check for the host aborting roughly every 10ms */
+	block = cfg.rate / 100;
+	if (block == 0)
+		block = 1;
+
+	la_start(&cfg);
+	while (!la_run(block)) {
+		timeout = 0;
+		len = cdc_recv(tty, buf, &timeout);
+		if (len < 0)
+			return false;
+		if (len > 0 && buf[0] == SUMP_RESET) {
+			debug_print("SUMP: capture aborted\r\n");
+			return true;
+		}
+	}
+
+	len = 0;
+	for (i = 0; i < sump->read; i++) {
+		for (g = 0; g < groups; g++) {
+			buf[len++] = (g == 0) ? la_get(i) : 0;
+			if (len == CDC_BUFSIZE) {
+				if (cdc_send_more(tty, buf, len) < 0)
+					return false;
+				len = 0;
+			}
+		}
+	}
+	/* Finish the transfer; a ZLP if we ended on a full packet */
+	cdc_send(tty, buf, len);
+
+	return true;
+}
+
+/*
+ * Entered from the main loop when we see the SUMP ID command. s / len are
+ * any further bytes received with it. Runs until the host disconnects.
+ */
+void sump_main(struct cdc *tty, const uint8_t *s, int len)
+{
+	struct sump_state *sump = &sump_state;
+	uint8_t buf[CDC_BUFSIZE];
+	uint8_t cmd[5];
+	uint32_t val;
+	int i, cmdlen;
+
+	sump_reset(sump);
+	bv_gpio_init();
+	cdc_send(tty, (uint8_t *) "1ALS", 4);
+
+	memcpy(buf, s, len);
+	cmdlen = 0;
+	while (1) {
+		for (i = 0; i < len; i++) {
+			cmd[cmdlen++] = buf[i];
+			/* Long commands have the top bit set */
+			if ((cmd[0] & 0x80) && cmdlen < 5)
+				continue;
+			cmdlen = 0;
+
+			val = cmd[1] | cmd[2] << 8 | cmd[3] << 16 |
+				(uint32_t) cmd[4] << 24;
+			switch (cmd[0]) {
+			case SUMP_RESET:
+				sump_reset(sump);
+				break;
+			case SUMP_ID:
+				cdc_send(tty, (uint8_t *) "1ALS", 4);
+				break;
+			case SUMP_METADATA:
+				sump_metadata(tty);
+				break;
+			case SUMP_RUN:
+				debug_print("SUMP: run\r\n");
+				if (!sump_run(tty, sump))
+					return;
+				break;
+			case SUMP_DIVIDER:
+				sump->divider = val & 0xFFFFFF;
+				break;
+			case SUMP_CNT:
+				sump->read = ((val & 0xFFFF) + 1) * 4;
+				sump->delay = ((val >> 16) + 1) * 4;
+				if (sump->read > la_max_samples())
+					sump->read = la_max_samples();
+				break;
+			case SUMP_FLAGS:
+				sump->flags = val;
+				break;
+			case SUMP_TRIG_MASK:
+			case SUMP_TRIG_MASK + 4:
+			case SUMP_TRIG_MASK + 8:
+			case SUMP_TRIG_MASK + 12:
+				sump->trig_mask[(cmd[0] >> 2) & 3] = val;
+				break;
+			case SUMP_TRIG_VAL:
+			case SUMP_TRIG_VAL + 4:
+			case SUMP_TRIG_VAL + 8:
+			case SUMP_TRIG_VAL + 12:
+				sump->trig_value[(cmd[0] >> 2) & 3] = val;
+				break;
+			case SUMP_TRIG_CFG:
+			case SUMP_TRIG_CFG + 4:
+			case SUMP_TRIG_CFG + 8:
+			case SUMP_TRIG_CFG + 12:
+				sump->trig_cfg[(cmd[0] >> 2) & 3] = val;
+				break;
+			case SUMP_PROTO_TRIG:
+				sump->proto = val;
+				break;
+			default:
+				/* XON/XOFF etc. */
+				break;
+			}
+		}
+
+		len = cdc_recv(tty, buf, NULL);
+		if (len < 0)
+			return;
+	}
+}
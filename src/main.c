@@ -34,6 +34,7 @@
 bool bpbin_main(struct cdc *tty);
 bool cli_main(struct cdc *tty, const uint8_t *s, int len);
 void ccproxy_main(struct cdc *tty, const uint8_t *s, int len);
+void sump_main(struct cdc *tty, const uint8_t *s, int len);
 
 #ifdef GNU_LINUX_EMULATION
 int emulated_main(int argc, const char *argv[])
@@ -50,7 +51,11 @@ int main(int argc, const char *argv[])
 	(void)argv;
 
 #ifdef GNU_LINUX_EMULATION
+#ifdef CDC_PTY
+	printf("Desk Viking " VER_STRING " (emulation with ptys), a Bus Pirate inspired debug tool.\n");
+#else
 	printf("Desk Viking " VER_STRING " (emulation with USBIP), a Bus Pirate inspired debug tool.\n");
+#endif
 #endif
 
 	chopstx_usec_wait(200*1000);
@@ -106,18 +111,28 @@ int main(int argc, const char *argv[])
 				debug_print("Entering CCLib proxy mode.\r\n");
 				ccproxy_main(tty, buf, size);
 			} else {
-				/* Bus Pirate modes; 1 == cli, 2 == raw, 0 == ignore */
+				/*
+				 * Bus Pirate modes; 1 == cli, 2 == raw,
+				 * 3 == SUMP, 0 == ignore
+				 */
 				int mode = 0;
 
 				if (buf[0] == '\r') {
 					/* Bus Pirate-like CLI if user hits enter */
 					zerocnt = 0;
 					mode = 1; /* Interactive */
-				} else if (buf[0] == 0) {
-					/* Bus Pirate raw mode after 20 NULs */
+				} else if (buf[0] == 0 || buf[0] == 0x02) {
+					/*
+					 * Bus Pirate raw mode after 20 NULs, or
+					 * SUMP ID (after up to 5 SUMP resets)
+					 */
 					for (i = 0; i < size && zerocnt < 20; i++) {
 						if (buf[i] == 0) {
 							zerocnt++;
+						} else if (buf[i] == 0x02) {
+							mode = 3; /* SUMP */
+							i++;
+							break;
 						} else {
 							zerocnt = 0;
 						}
@@ -137,6 +152,11 @@ int main(int argc, const char *argv[])
 					} else if (mode == 2) {
 						debug_print("Entering Bus Pirate binary mode.\r\n");
 						mode = bpbin_main(tty) ? 1 : 0;
+					} else if (mode == 3) {
+						debug_print("Entering SUMP logic analyser mode.\r\n");
+						sump_main(tty, &buf[i], size - i);
+						zerocnt = 0;
+						mode = 0;
 					}
 				}
 			}
@@ -79,11 +79,25 @@ uint8_t bp_read_state(void)
 	return resp;
 }
 
+/**
+ * Converts a pin state byte, as used by the bitbang commands, into the
+ * matching pin mask for gpio_port_set(). All the probe pins are on the same
+ * port as PIN_AUX.
+ *
+ * :param state: Lower 5 bits are the desired state for aux/mosi/clk/miso/cs
+ * :return: GPIO_MASK() bits of the pins to set high
+ */
+uint32_t bp_state_port(uint8_t state)
+{
+	return ((state & 0x10) ? GPIO_MASK(PIN_AUX) : 0) |
+		((state & 0x8) ? GPIO_MASK(PIN_MOSI) : 0) |
+		((state & 0x4) ? GPIO_MASK(PIN_CLK) : 0) |
+		((state & 0x2) ? GPIO_MASK(PIN_MISO) : 0) |
+		((state & 0x1) ? GPIO_MASK(PIN_CS) : 0);
+}
+
 void bp_set_state(uint8_t state)
 {
-	gpio_set(PIN_AUX, state & 0x10);
-	gpio_set(PIN_MOSI, state & 0x8);
-	gpio_set(PIN_CLK, state & 0x4);
-	gpio_set(PIN_MISO, state & 0x2);
-	gpio_set(PIN_CS, state & 0x1);
+	/* Update all the pins at once rather than one at a time */
+	gpio_port_set(PIN_AUX, bp_state_port(state), bp_state_port(0x1F));
 }
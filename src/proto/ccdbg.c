@@ -44,6 +44,18 @@
 #define CC_ERROR_NOT_DEBUGGING	2
 #define CC_ERROR_NOT_WIRED	3
 
+/* Default DC half period, which all of the CC parts are happy with */
+#define CCDBG_DEFAULT_HALF_NS	2000
+
+/*
+ * Half periods (in ns) tried by ccdbg_autotune(), slowest first. 0 means as
+ * fast as we can toggle the pins.
+ */
+static const uint16_t ccdbg_tune_ns[] = {
+	2000, 1000, 500, 250, 125, 50, 0,
+};
+#define CCDBG_TUNE_STEPS	(sizeof(ccdbg_tune_ns) / sizeof(ccdbg_tune_ns[0]))
+
 struct ccdbg_state {
 	/* Instruction table */
 	uint8_t instr[CCDBG_INSTRLEN];
@@ -53,44 +65,107 @@ struct ccdbg_state {
 	uint8_t dc;
 	uint8_t dd;
 
+	/*
+	 * Port masks, precomputed so each clock edge is a single store. If DD
+	 * shares a port with DC its data bit goes out in the same store as
+	 * the rising edge (dd_same), otherwise it needs its own (dd_split).
+	 */
+	uint32_t dc_mask;
+	uint32_t dd_mask;
+	uint32_t dd_same;
+	uint32_t dd_split;
+
+	/* DC half period, in DWT cycles */
+	uint32_t half;
+
 	uint8_t error;
 	bool active;
 	bool indebug;
 };
 
+/*
+ * Clocks in a single bit: clock high, half period, sample DD, clock low,
+ * half period. Each edge is timed from the previous one rather than
+ * delaying after it, so the time spent driving the pins counts towards the
+ * period.
+ */
+static inline uint8_t ccdbg_read_bit(struct ccdbg_state *ctx, uint32_t *t)
+{
+	uint32_t port;
+
+	gpio_port_set(ctx->dc, ctx->dc_mask, 0);
+	*t += ctx->half;
+	dwt_wait_until(*t);
+	port = gpio_port_get(ctx->dd);
+	gpio_port_set(ctx->dc, 0, ctx->dc_mask);
+	*t += ctx->half;
+	dwt_wait_until(*t);
+
+	return (port & ctx->dd_mask) ? 1 : 0;
+}
+
 static uint8_t ccdbg_read_int(struct ccdbg_state *ctx)
 {
-	uint8_t b, i;
+	uint32_t t;
+	uint8_t b;
 
 	if (!ctx->active) {
 		ctx->error = CC_ERROR_NOT_ACTIVE;
 		return 0;
 	}
 
-	/*
-	 * Read data msb first
-	 * clk high, 2 ms, read state, clock low, 2ms
-	 */
+	/* Read data msb first */
 	gpio_set_input(ctx->dd);
-	b = 0;
-	for (i = 0; i < 8; i++) {
-		/* Toggle clock and shift data in */
-		gpio_set(ctx->dc, true);
-		dwt_delay(2);
-		b <<= 1;
-		if (gpio_get(ctx->dd))
-			b |= 1;
-		gpio_set(ctx->dc, false);
-		dwt_delay(2);
-	}
+	t = dwt_cycles();
+	b = ccdbg_read_bit(ctx, &t) << 7;
+	b |= ccdbg_read_bit(ctx, &t) << 6;
+	b |= ccdbg_read_bit(ctx, &t) << 5;
+	b |= ccdbg_read_bit(ctx, &t) << 4;
+	b |= ccdbg_read_bit(ctx, &t) << 3;
+	b |= ccdbg_read_bit(ctx, &t) << 2;
+	b |= ccdbg_read_bit(ctx, &t) << 1;
+	b |= ccdbg_read_bit(ctx, &t);
 
 	return b;
 }
 
-bool ccdbg_write(struct ccdbg_state *ctx, uint8_t b)
+/*
+ * Clocks out a single bit. The target samples DD on the falling edge of DC,
+ * so we drive the data with the rising edge.
+ */
+static inline void ccdbg_write_bit(struct ccdbg_state *ctx, uint32_t *t,
+		bool bit)
 {
-	int i;
+	if (ctx->dd_split)
+		gpio_port_set(ctx->dd, bit ? ctx->dd_split : 0,
+				bit ? 0 : ctx->dd_split);
+	gpio_port_set(ctx->dc, ctx->dc_mask | (bit ? ctx->dd_same : 0),
+			bit ? 0 : ctx->dd_same);
+	*t += ctx->half;
+	dwt_wait_until(*t);
+	gpio_port_set(ctx->dc, 0, ctx->dc_mask);
+	*t += ctx->half;
+	dwt_wait_until(*t);
+}
+
+/* Clocks a byte out, msb first; DD must already be an output */
+static void ccdbg_write_int(struct ccdbg_state *ctx, uint8_t b)
+{
+	uint32_t t;
+
+	t = dwt_cycles();
+	ccdbg_write_bit(ctx, &t, b & 0x80);
+	ccdbg_write_bit(ctx, &t, b & 0x40);
+	ccdbg_write_bit(ctx, &t, b & 0x20);
+	ccdbg_write_bit(ctx, &t, b & 0x10);
+	ccdbg_write_bit(ctx, &t, b & 0x08);
+	ccdbg_write_bit(ctx, &t, b & 0x04);
+	ccdbg_write_bit(ctx, &t, b & 0x02);
+	ccdbg_write_bit(ctx, &t, b & 0x01);
+}
 
+bool ccdbg_write(struct ccdbg_state *ctx, uint8_t b)
+{
 	if (!ctx->active) {
 		ctx->error = CC_ERROR_NOT_ACTIVE;
 		return false;
@@ -100,31 +175,15 @@ bool ccdbg_write(struct ccdbg_state *ctx, uint8_t b)
 		return false;
 	}
 
-	/*
-	 * DD output
-	 * clock data out msb first
-	 *  clock high, 2ms, clock low, 2ms
-	 */
 	gpio_set_output(ctx->dd, false);
-	for (i = 0; i < 8; i++) {
-		if (b & 0x80)
-			gpio_set(ctx->dd, true);
-		else
-			gpio_set(ctx->dd, false);
-
-		/* Toggle clock and shift data */
-		gpio_set(ctx->dc, true);
-		b <<= 1;
-		dwt_delay(2);
-		gpio_set(ctx->dc, false);
-		dwt_delay(2);
-	}
+	ccdbg_write_int(ctx, b);
 
 	return true;
 }
 
 static bool ccdbg_switchread(struct ccdbg_state *ctx)
 {
+	uint32_t t;
 	int i, count;
 
 	if (!ctx->active) {
@@ -138,22 +197,19 @@ static bool ccdbg_switchread(struct ccdbg_state *ctx)
 
 	/*
 	 * DD input
-	 * Wait 2ms
+	 * Wait a half period
 	 * while DD is high
-	 *   8: clk high, 2ms, clk low, 2ms
+	 *   8: clk high, half period, clk low, half period
 	 *
 	 * Limit cycles to 255.
 	 */
 	gpio_set_input(ctx->dd);
-	dwt_delay(2);
+	t = dwt_cycles() + ctx->half;
+	dwt_wait_until(t);
 	count = 255;
-	while (gpio_get(ctx->dd)) {
-		for (i = 0; i < 8; i++) {
-			gpio_set(ctx->dc, true);
-			dwt_delay(2);
-			gpio_set(ctx->dc, false);
-			dwt_delay(2);
-		}
+	while (gpio_port_get(ctx->dd) & ctx->dd_mask) {
+		for (i = 0; i < 8; i++)
+			ccdbg_read_bit(ctx, &t);
 		if (!--count) {
 			ctx->error = CC_ERROR_NOT_WIRED;
 			ctx->indebug = false;
@@ -162,7 +218,7 @@ static bool ccdbg_switchread(struct ccdbg_state *ctx)
 	}
 
 	if (count < 255)
-		dwt_delay(2);
+		dwt_wait_until(t + ctx->half);
 
 	return true;
 }
@@ -318,6 +374,113 @@ uint8_t ccdbg_writecfg(struct ccdbg_state *ctx, uint8_t c)
 	return ccdbg_read(ctx);
 }
 
+/**
+ * Writes a block of data into the target's XDATA space using debug
+ * instructions.
+ *
+ * :param addr: XDATA address to start writing at
+ * :param buf: Data to write
+ * :param len: Number of bytes to write
+ * :return: True on success, false on error (see ccdbg_error())
+ */
+bool ccdbg_write_xdata(struct ccdbg_state *ctx, uint16_t addr,
+		const uint8_t *buf, int len)
+{
+	int i;
+
+	/* MOV DPTR, #addr */
+	ccdbg_exec3(ctx, 0x90, addr >> 8, addr & 0xFF);
+	for (i = 0; i < len; i++) {
+		/* MOV A, #data */
+		ccdbg_exec2(ctx, 0x74, buf[i]);
+		/* MOVX @DPTR, A */
+		ccdbg_exec1(ctx, 0xF0);
+		/* INC DPTR */
+		ccdbg_exec1(ctx, 0xA3);
+	}
+
+	return ctx->error == CC_ERROR_NONE;
+}
+
+/**
+ * Reads a single byte from the target's XDATA space.
+ */
+uint8_t ccdbg_read_xdata(struct ccdbg_state *ctx, uint16_t addr)
+{
+	/* MOV DPTR, #addr */
+	ccdbg_exec3(ctx, 0x90, addr >> 8, addr & 0xFF);
+	/* MOVX A, @DPTR */
+	return ccdbg_exec1(ctx, 0xE0);
+}
+
+/**
+ * Reads a block from the target's XDATA space, starting at the current DPTR
+ * and leaving DPTR just past the end. There's no auto-incrementing read in
+ * the debug protocol, so each byte is still a MOVX A, @DPTR and an INC DPTR,
+ * but they're issued back to back with the state checks done once for the
+ * whole block rather than per command.
+ *
+ * :param buf: Buffer to read into
+ * :param len: Number of bytes to read
+ * :return: Number of bytes read; short on error (see ccdbg_error())
+ */
+int ccdbg_read_xdata_inc(struct ccdbg_state *ctx, uint8_t *buf, int len)
+{
+	uint8_t instr;
+	int i;
+
+	if (!ccdbg_write(ctx, ctx->instr[I_DEBUG_INSTR_1]))
+		return 0;
+	instr = ctx->instr[I_DEBUG_INSTR_1];
+
+	for (i = 0; i < len; i++) {
+		/* MOVX A, @DPTR; first command byte already sent */
+		if (i != 0) {
+			gpio_set_output(ctx->dd, false);
+			ccdbg_write_int(ctx, instr);
+		}
+		ccdbg_write_int(ctx, 0xE0);
+		if (!ccdbg_switchread(ctx))
+			break;
+		buf[i] = ccdbg_read_int(ctx);
+
+		/* INC DPTR, we don't care about the result */
+		gpio_set_output(ctx->dd, false);
+		ccdbg_write_int(ctx, instr);
+		ccdbg_write_int(ctx, 0xA3);
+		if (!ccdbg_switchread(ctx))
+			break;
+		ccdbg_read_int(ctx);
+	}
+	ccdbg_switchwrite(ctx);
+
+	return i;
+}
+
+/**
+ * Sends data to the target's DBGDATA register with the debug BURST_WRITE
+ * command, triggering a DMA transfer per byte.
+ *
+ * :param buf: Data to write
+ * :param len: Number of bytes, 1-2048
+ * :return: The debug status after the write
+ */
+uint8_t ccdbg_burstwrite(struct ccdbg_state *ctx, const uint8_t *buf, int len)
+{
+	int i;
+
+	if (!ccdbg_write(ctx, 0x80 | ((len >> 8) & 7)))
+		return 0;
+	if (!ccdbg_write(ctx, len & 0xFF))
+		return 0;
+	for (i = 0; i < len; i++) {
+		if (!ccdbg_write(ctx, buf[i]))
+			return 0;
+	}
+
+	return ccdbg_read(ctx);
+}
+
 uint8_t ccdbg_instrtblver(struct ccdbg_state *ctx)
 {
 	return ctx->instr[INSTR_VERSION];
@@ -369,6 +532,89 @@ uint16_t ccdbg_getPC(struct ccdbg_state *ctx)
 	return pc;
 }
 
+/**
+ * Sets the half period of the debug clock (DC). The debug interface is
+ * fully static so can be clocked as slowly as we like; how fast it can go
+ * depends on the part and the wiring.
+ *
+ * :param ns: Half period in ns; 0 to toggle as fast as possible
+ * :return: The half period actually used, rounded to our timer resolution
+ */
+uint16_t ccdbg_set_clock(struct ccdbg_state *ctx, uint16_t ns)
+{
+	ctx->half = (ns * MHZ + 999) / 1000;
+	/* Rounding up mustn't take us past what we can report back */
+	if (ctx->half > 0xFFFF * MHZ / 1000)
+		ctx->half = 0xFFFF * MHZ / 1000;
+
+	return ctx->half * 1000 / MHZ;
+}
+
+/*
+ * Checks the debug interface is working reliably at the current clock by
+ * loading a set of patterns into the accumulator and reading them back.
+ */
+static bool ccdbg_clock_ok(struct ccdbg_state *ctx, uint16_t chipid)
+{
+	static const uint8_t patterns[] = { 0x00, 0xFF, 0x55, 0xAA, 0x5A };
+	unsigned int i;
+
+	ctx->error = CC_ERROR_NONE;
+	if (ccdbg_chipid(ctx) != chipid)
+		return false;
+
+	for (i = 0; i < sizeof(patterns); i++) {
+		/* MOV A, #data */
+		if (ccdbg_exec2(ctx, 0x74, patterns[i]) != patterns[i] ||
+				ctx->error != CC_ERROR_NONE)
+			return false;
+	}
+
+	return true;
+}
+
+/**
+ * Finds the fastest debug clock that works reliably, stepping up from the
+ * default speed until readback verification fails. The target must be
+ * halted in debug mode; the accumulator is overwritten, and the target is
+ * reset back into debug mode if a speed fails.
+ *
+ * :return: The half period chosen, in ns, or -1 if even the default speed
+ *          doesn't work.
+ */
+int ccdbg_autotune(struct ccdbg_state *ctx)
+{
+	int best, i;
+	uint16_t chipid;
+
+	ccdbg_set_clock(ctx, CCDBG_DEFAULT_HALF_NS);
+	chipid = ccdbg_chipid(ctx);
+	if (ctx->error != CC_ERROR_NONE || chipid == 0 || chipid == 0xFFFF)
+		return -1;
+
+	best = -1;
+	for (i = 0; i < (int) CCDBG_TUNE_STEPS; i++) {
+		ccdbg_set_clock(ctx, ccdbg_tune_ns[i]);
+		if (!ccdbg_clock_ok(ctx, chipid))
+			break;
+		best = i;
+	}
+
+	if (best < 0) {
+		ccdbg_set_clock(ctx, CCDBG_DEFAULT_HALF_NS);
+		ccdbg_enter(ctx);
+		return -1;
+	}
+
+	ccdbg_set_clock(ctx, ccdbg_tune_ns[best]);
+	if (i < (int) CCDBG_TUNE_STEPS) {
+		/* The failed attempt may have left the target out of step */
+		ccdbg_enter(ctx);
+	}
+
+	return ccdbg_tune_ns[best];
+}
+
 /* Avoid dynamic allocations */
 static struct ccdbg_state static_state;
 
@@ -380,6 +626,16 @@ struct ccdbg_state *ccdbg_init(uint8_t rst, uint8_t dc, uint8_t dd)
 	ctx->dc = dc;
 	ctx->dd = dd;
 
+	ctx->dc_mask = GPIO_MASK(dc);
+	ctx->dd_mask = GPIO_MASK(dd);
+	if ((dc >> 4) == (dd >> 4)) {
+		ctx->dd_same = ctx->dd_mask;
+		ctx->dd_split = 0;
+	} else {
+		ctx->dd_same = 0;
+		ctx->dd_split = ctx->dd_mask;
+	}
+
 	/*
 	 * Set rst/dc to output, dd to input
 	 * All low / no pull up
@@ -402,6 +658,8 @@ struct ccdbg_state *ccdbg_init(uint8_t rst, uint8_t dc, uint8_t dd)
 	ctx->instr[I_STEP_INSTR]     = 0x58;
 	ctx->instr[I_CHIP_ERASE]     = 0x10;
 
+	ccdbg_set_clock(ctx, CCDBG_DEFAULT_HALF_NS);
+
 	ctx->error = CC_ERROR_NONE;
 	ctx->active = true;
 	ctx->indebug = false;
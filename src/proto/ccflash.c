@@ -0,0 +1,199 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ * On-device flash programming for CC253x parts via the debug interface
+ *
+ * Runs the same DMA based sequence as CCLib's writeCODE(): debug burst
+ * write into RAM via DMA channel 0, then RAM into the flash controller via
+ * DMA channel 1, but drives it all from here rather than as thousands of
+ * individual debug commands from the host.
+ *
+ * Copyright 2021 Jonathan McDowell <noodles@earth.li>
+ */
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "ccdbg.h"
+#include "ccflash.h"
+#include "dwt.h"
+
+/* XDATA mapped registers */
+#define XREG_DBGDATA	0x6260
+#define XREG_FCTL	0x6270
+#define XREG_FADDRL	0x6271
+#define XREG_FWDATA	0x6273
+#define XREG_DMAIRQ	0x70D1
+#define XREG_DMA1CFGL	0x70D2
+#define XREG_DMA0CFGL	0x70D4
+#define XREG_DMAARM	0x70D6
+
+#define FCTL_BUSY	0x80
+#define FCTL_ABORT	0x20
+/* Cache mode bits, preserved as the default "cache enabled" */
+#define FCTL_CM		0x04
+#define FCTL_WRITE	0x02
+#define FCTL_ERASE	0x01
+
+/* DMA triggers */
+#define DMA_TRIG_FLASH	0x12
+#define DMA_TRIG_DBG_BW	0x1F
+
+/* Where we stage the page data and DMA descriptors in target RAM */
+#define RAM_BUF		0x0000
+#define RAM_DESC	0x1000
+
+/*
+ * Datasheet page erase and per 32 bit word write times, in µs, and how many
+ * times longer than that we'll wait before giving up.
+ */
+#define CCFLASH_ERASE_US	20000
+#define CCFLASH_WORD_US		20
+#define CCFLASH_SLACK		2
+/* DMA completes as soon as its trigger source is done, so is quick */
+#define CCFLASH_DMA_US		1000
+
+/*
+ * Builds an 8 byte DMA descriptor; single mode, byte transfers, fixed
+ * length, IRQ enabled.
+ */
+static void ccflash_dma_desc(uint8_t *desc, uint16_t src, uint16_t dst,
+		int len, uint8_t trig, bool srcinc, bool dstinc, uint8_t prio)
+{
+	desc[0] = src >> 8;
+	desc[1] = src & 0xFF;
+	desc[2] = dst >> 8;
+	desc[3] = dst & 0xFF;
+	desc[4] = (len >> 8) & 0x1F;
+	desc[5] = len & 0xFF;
+	desc[6] = trig;
+	desc[7] = (srcinc ? 0x40 : 0) | (dstinc ? 0x10 : 0) | 0x08 | prio;
+}
+
+/* Waits for the given DMA channel to signal completion */
+static bool ccflash_dma_wait(struct ccdbg_state *ctx, int channel)
+{
+	uint32_t deadline;
+
+	deadline = dwt_cycles() + CCFLASH_DMA_US * MHZ;
+	while ((int32_t) (deadline - dwt_cycles()) > 0) {
+		if (ccdbg_read_xdata(ctx, XREG_DMAIRQ) & (1 << channel))
+			return true;
+		if (ccdbg_error(ctx))
+			return false;
+	}
+
+	return false;
+}
+
+/*
+ * Waits up to the given time for the flash controller to finish, returning
+ * the final FCTL
+ */
+static enum ccflash_status ccflash_busy_wait(struct ccdbg_state *ctx,
+		uint32_t usec)
+{
+	uint32_t deadline;
+	uint8_t fctl;
+
+	deadline = dwt_cycles() + usec * CCFLASH_SLACK * MHZ;
+	while ((int32_t) (deadline - dwt_cycles()) > 0) {
+		fctl = ccdbg_read_xdata(ctx, XREG_FCTL);
+		if (ccdbg_error(ctx))
+			return CCFLASH_DEBUG;
+		if (!(fctl & FCTL_BUSY))
+			return (fctl & FCTL_ABORT) ? CCFLASH_ABORT : CCFLASH_OK;
+	}
+
+	return CCFLASH_BUSY_TIMEOUT;
+}
+
+/* Sets the flash controller address; FADDR is in 32 bit words */
+static bool ccflash_set_addr(struct ccdbg_state *ctx, uint32_t addr)
+{
+	uint8_t faddr[2];
+
+	faddr[0] = (addr >> 2) & 0xFF;
+	faddr[1] = (addr >> 10) & 0xFF;
+
+	return ccdbg_write_xdata(ctx, XREG_FADDRL, faddr, 2);
+}
+
+static bool ccflash_xreg(struct ccdbg_state *ctx, uint16_t reg, uint8_t val)
+{
+	return ccdbg_write_xdata(ctx, reg, &val, 1);
+}
+
+/**
+ * Programs (part of) a flash page, optionally erasing it first. The target
+ * must be halted in debug mode; its RAM at 0x0000-0x0800 and 0x1000-0x1010
+ * is used as scratch space.
+ *
+ * :param page: Flash page number (2KB pages)
+ * :param buf: Data to write to the start of the page
+ * :param len: Length of the data; a multiple of 4, up to CCFLASH_PAGE_SIZE
+ * :param erase: True to erase the page first
+ * :return: CCFLASH_OK on success, otherwise the failure reason
+ */
+enum ccflash_status ccflash_write_page(struct ccdbg_state *ctx, uint8_t page,
+		const uint8_t *buf, int len, bool erase)
+{
+	enum ccflash_status status;
+	uint8_t desc[16], cfg[2];
+	uint32_t addr;
+
+	if (page > 127 || len <= 0 || len > CCFLASH_PAGE_SIZE || (len & 3))
+		return CCFLASH_RANGE;
+	addr = (uint32_t) page * CCFLASH_PAGE_SIZE;
+
+	/* DMA 0: debug interface -> RAM, DMA 1: RAM -> flash controller */
+	ccflash_dma_desc(&desc[0], XREG_DBGDATA, RAM_BUF, len,
+			DMA_TRIG_DBG_BW, false, true, 1);
+	ccflash_dma_desc(&desc[8], RAM_BUF, XREG_FWDATA, len,
+			DMA_TRIG_FLASH, true, false, 2);
+	if (!ccdbg_write_xdata(ctx, RAM_DESC, desc, sizeof(desc)))
+		return CCFLASH_DEBUG;
+
+	cfg[0] = RAM_DESC & 0xFF;
+	cfg[1] = RAM_DESC >> 8;
+	if (!ccdbg_write_xdata(ctx, XREG_DMA0CFGL, cfg, 2))
+		return CCFLASH_DEBUG;
+	cfg[0] = (RAM_DESC + 8) & 0xFF;
+	cfg[1] = (RAM_DESC + 8) >> 8;
+	if (!ccdbg_write_xdata(ctx, XREG_DMA1CFGL, cfg, 2))
+		return CCFLASH_DEBUG;
+
+	if (!ccflash_xreg(ctx, XREG_DMAIRQ, 0))
+		return CCFLASH_DEBUG;
+
+	if (erase) {
+		if (!ccflash_set_addr(ctx, addr) ||
+				!ccflash_xreg(ctx, XREG_FCTL,
+					FCTL_CM | FCTL_ERASE))
+			return CCFLASH_DEBUG;
+		status = ccflash_busy_wait(ctx, CCFLASH_ERASE_US);
+		if (status != CCFLASH_OK)
+			return status;
+	}
+
+	/* Stage the data in RAM */
+	if (!ccflash_xreg(ctx, XREG_DMAARM, 0x01))
+		return CCFLASH_DEBUG;
+	ccdbg_burstwrite(ctx, buf, len);
+	if (ccdbg_error(ctx))
+		return CCFLASH_DEBUG;
+	if (!ccflash_dma_wait(ctx, 0))
+		return ccdbg_error(ctx) ? CCFLASH_DEBUG : CCFLASH_DMA_TIMEOUT;
+
+	/* Then feed it to the flash controller */
+	if (!ccflash_set_addr(ctx, addr) ||
+			!ccflash_xreg(ctx, XREG_DMAARM, 0x02) ||
+			!ccflash_xreg(ctx, XREG_FCTL, FCTL_CM | FCTL_WRITE))
+		return CCFLASH_DEBUG;
+
+	status = ccflash_busy_wait(ctx, (len / 4) * CCFLASH_WORD_US);
+	if (status != CCFLASH_OK)
+		return status;
+	if (!ccflash_dma_wait(ctx, 1))
+		return ccdbg_error(ctx) ? CCFLASH_DEBUG : CCFLASH_DMA_TIMEOUT;
+
+	return CCFLASH_OK;
+}
@@ -0,0 +1,174 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ * Bulk DS18B20 style 1-Wire temperature survey
+ *
+ * Starts a conversion on every device on the bus with a single broadcast,
+ * polls for completion rather than waiting a fixed 750ms, then reads back
+ * each device's scratchpad in turn, all on the device rather than driven a
+ * byte at a time from the host.
+ *
+ * Copyright 2021 Jonathan McDowell <noodles@earth.li>
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "crc.h"
+#include "ds18b20.h"
+#include "dwt.h"
+#include "w1.h"
+
+/*
+ * How often we poll for conversion completion, and how many times. A 12 bit
+ * conversion takes up to 750ms, so this allows a generous margin.
+ */
+#define DS18B20_POLL_US		1000
+#define DS18B20_POLL_MAX	1000
+
+/**
+ * Checks if a 1-Wire family code is one of the temperature sensors that
+ * have a DS18B20 compatible scratchpad.
+ *
+ * :param family: First byte of the ROM ID
+ * :return: True if the device can be included in a survey
+ */
+bool ds18b20_family(uint8_t family)
+{
+	switch (family) {
+	case 0x10:	/* DS18S20 */
+	case 0x22:	/* DS1822 */
+	case 0x28:	/* DS18B20 */
+	case 0x3B:	/* MAX31850 */
+	case 0x42:	/* DS28EA00 */
+		return true;
+	default:
+		return false;
+	}
+}
+
+/**
+ * Starts a temperature conversion on every device on the bus using Skip
+ * ROM, then waits for them all to finish. Devices hold read slots low
+ * while converting, so we poll until the bus reads back a 1. This doesn't
+ * work for parasite powered devices, which need a strong pull-up instead.
+ *
+ * :return: True if the conversion completed, false if there was no device
+ *          or it timed out
+ */
+bool ds18b20_convert_all(void)
+{
+	int i;
+
+	if (w1_reset(false) != W1_PRESENT)
+		return false;
+
+	w1_write(W1_SKIP_ROM);
+	w1_write(DS18B20_CONVERT_T);
+
+	for (i = 0; i < DS18B20_POLL_MAX; i++) {
+		if (w1_read_bit())
+			return true;
+		dwt_sleep(DS18B20_POLL_US);
+	}
+
+	return false;
+}
+
+/*
+ * Reads back the scratchpad of a single device and works out its
+ * temperature.
+ */
+static void ds18b20_read(const uint8_t devid[8], bool converted,
+		struct ds18b20_reading *reading)
+{
+	uint8_t scratch[9];
+	int i;
+
+	memcpy(reading->devid, devid, 8);
+	reading->status = converted ? 0 : DS18B20_TIMEOUT;
+	reading->temp = 0;
+
+	w1_reset(false);
+	w1_write(W1_MATCH_ROM);
+	for (i = 0; i < 8; i++)
+		w1_write(devid[i]);
+	w1_write(DS18B20_READ_SCRATCH);
+	w1_read(scratch, sizeof(scratch));
+
+	/* A missing device reads as all 1s, which fails the CRC */
+	if (crc8_maxim(0, scratch, sizeof(scratch)) != 0) {
+		reading->status |= DS18B20_CRC_BAD;
+		return;
+	}
+
+	reading->temp = (int16_t) (scratch[0] | (scratch[1] << 8));
+	/* The DS18S20 reports in 1/2 °C */
+	if (devid[0] == 0x10)
+		reading->temp *= 8;
+}
+
+/*
+ * Moves on to the next temperature sensor on the bus, skipping over any
+ * other devices.
+ */
+static bool ds18b20_survey_read(struct ds18b20_survey *survey, bool found,
+		struct ds18b20_reading *reading)
+{
+	while (found && !ds18b20_family(survey->devid[0]))
+		found = w1_find_next(&survey->search, survey->devid);
+
+	if (!found)
+		return false;
+
+	ds18b20_read(survey->devid, survey->converted, reading);
+
+	return true;
+}
+
+/**
+ * Starts a survey; triggers a conversion on every device, then reads the
+ * first sensor found. Devices are discovered with a ROM search as the
+ * survey goes, the search continuing between scratchpad reads.
+ *
+ * :param survey: Pointer to a state structure for the survey. Will be
+ *                initialised by this function.
+ * :param reading: Filled in with the reading from the first sensor
+ * :return: True if a sensor was found, false otherwise.
+ */
+bool ds18b20_survey_first(struct ds18b20_survey *survey,
+		struct ds18b20_reading *reading)
+{
+	bool found;
+
+	survey->converted = ds18b20_convert_all();
+	found = w1_find_first(W1_ROM_SEARCH, &survey->search, survey->devid);
+
+	return ds18b20_survey_read(survey, found, reading);
+}
+
+/**
+ * Reads the next sensor in a survey started with ds18b20_survey_first().
+ *
+ * :return: True if a sensor was found, false once they've all been read.
+ */
+bool ds18b20_survey_next(struct ds18b20_survey *survey,
+		struct ds18b20_reading *reading)
+{
+	bool found;
+
+	found = w1_find_next(&survey->search, survey->devid);
+
+	return ds18b20_survey_read(survey, found, reading);
+}
+
+/**
+ * Packs a reading into DS18B20_RECLEN bytes for sending to the host: the
+ * ROM ID, the temperature in 1/16 °C (little endian) and the status flags.
+ */
+void ds18b20_pack(const struct ds18b20_reading *reading, uint8_t *buf)
+{
+	memcpy(buf, reading->devid, 8);
+	buf[8] = reading->temp & 0xFF;
+	buf[9] = (reading->temp >> 8) & 0xFF;
+	buf[10] = reading->status;
+}
@@ -0,0 +1,341 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ * 24Cxx style I2C EEPROM read/program engine
+ *
+ * Does sequential reads, page sized writes with ACK polling for write cycle
+ * completion, and read back verification, all on the device rather than
+ * driven a byte at a time from the host.
+ *
+ * Copyright 2021 Jonathan McDowell <noodles@earth.li>
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "crc.h"
+#include "dwt.h"
+#include "eeprom.h"
+#include "i2c.h"
+
+/*
+ * How long to poll for a write cycle to complete, in µs. Well over the
+ * 5-10ms maximum write cycle time of common parts, whatever the bus speed.
+ */
+#define EEPROM_WRITE_US	50000
+
+const struct eeprom_type eeprom_types[EEPROM_TYPE_COUNT] = {
+	{ "24C01",     128,   8, 1 },
+	{ "24C02",     256,   8, 1 },
+	{ "24C04",     512,  16, 1 },
+	{ "24C08",    1024,  16, 1 },
+	{ "24C16",    2048,  16, 1 },
+	{ "24C32",    4096,  32, 2 },
+	{ "24C64",    8192,  32, 2 },
+	{ "24C128",  16384,  64, 2 },
+	{ "24C256",  32768,  64, 2 },
+	{ "24C512",  65536, 128, 2 },
+	{ "24C1024", 131072, 256, 2 },
+};
+
+struct eeprom_prog {
+	const struct eeprom_type *type;
+	uint8_t addr;
+	/* Device offset of the start of page[] */
+	uint32_t ofs;
+	/* Device offset of the end of the range being programmed */
+	uint32_t end;
+	/* Number of bytes currently held in page[] */
+	uint16_t fill;
+	uint16_t crc;
+	enum eeprom_status status;
+	uint8_t page[EEPROM_MAX_PAGE];
+};
+
+/*
+ * Parts with single byte word addresses but more than 256 bytes use the low
+ * bits of the device address as the top bits of the word address (and the
+ * 24C1024 does likewise above 64K).
+ */
+static uint8_t eeprom_dev(const struct eeprom_type *type, uint8_t addr,
+		uint32_t ofs)
+{
+	return addr | ((ofs >> (8 * type->addr_bytes)) & 7);
+}
+
+static int eeprom_word_addr(const struct eeprom_type *type, uint32_t ofs,
+		uint8_t *buf)
+{
+	if (type->addr_bytes == 2) {
+		buf[0] = (ofs >> 8) & 0xFF;
+		buf[1] = ofs & 0xFF;
+	} else {
+		buf[0] = ofs & 0xFF;
+	}
+
+	return type->addr_bytes;
+}
+
+static bool eeprom_range_ok(const struct eeprom_type *type, uint32_t ofs,
+		uint32_t len)
+{
+	return ofs <= type->size && len <= (type->size - ofs);
+}
+
+/*
+ * Wait for the device to finish an internal write cycle; it won't ACK its
+ * address until it's done.
+ */
+static enum eeprom_status eeprom_poll(uint8_t dev)
+{
+	uint32_t deadline;
+	bool nack;
+
+	deadline = dwt_cycles() + EEPROM_WRITE_US * MHZ;
+	while ((int32_t) (deadline - dwt_cycles()) > 0) {
+		i2c_start();
+		nack = i2c_write(dev << 1);
+		i2c_stop();
+
+		if (!nack)
+			return EEPROM_OK;
+	}
+
+	return EEPROM_TIMEOUT;
+}
+
+/* Write up to a page; must not cross a page boundary */
+static enum eeprom_status eeprom_write_page(const struct eeprom_type *type,
+		uint8_t addr, uint32_t ofs, const uint8_t *buf, int len)
+{
+	uint8_t dev = eeprom_dev(type, addr, ofs);
+	uint8_t hdr[2];
+	int hdrlen;
+	bool ok;
+
+	hdrlen = eeprom_word_addr(type, ofs, hdr);
+
+	i2c_start();
+	ok = !i2c_write(dev << 1) &&
+		i2c_write_buf(hdr, hdrlen, false) == hdrlen &&
+		i2c_write_buf(buf, len, false) == len;
+	/* The write cycle begins on the stop condition */
+	i2c_stop();
+
+	if (!ok)
+		return EEPROM_NACK;
+
+	return eeprom_poll(dev);
+}
+
+/**
+ * Reads a range of the EEPROM using sequential reads.
+ *
+ * :param type: Geometry of the device
+ * :param addr: Base 7-bit I2C address of the device (usually 0x50)
+ * :param ofs: Offset within the EEPROM to start reading from
+ * :param buf: Buffer to store the data read
+ * :param len: Number of bytes to read
+ * :return: EEPROM_OK on success, otherwise the failure reason
+ */
+enum eeprom_status eeprom_read(const struct eeprom_type *type, uint8_t addr,
+		uint32_t ofs, uint8_t *buf, int len)
+{
+	uint32_t block;
+	uint8_t hdr[2];
+	int chunk, hdrlen;
+
+	if (len < 0 || !eeprom_range_ok(type, ofs, len))
+		return EEPROM_RANGE;
+
+	block = 1UL << (8 * type->addr_bytes);
+	while (len > 0) {
+		/* Don't let a sequential read run over a block boundary */
+		chunk = block - (ofs & (block - 1));
+		if (chunk > len)
+			chunk = len;
+
+		hdrlen = eeprom_word_addr(type, ofs, hdr);
+		if (!i2c_xfer(eeprom_dev(type, addr, ofs), hdr, hdrlen,
+				buf, chunk))
+			return EEPROM_NACK;
+
+		ofs += chunk;
+		buf += chunk;
+		len -= chunk;
+	}
+
+	return EEPROM_OK;
+}
+
+/**
+ * Writes a range of the EEPROM, splitting it into page writes and ACK
+ * polling for completion of each one. Does not verify the written data.
+ *
+ * :param type: Geometry of the device
+ * :param addr: Base 7-bit I2C address of the device (usually 0x50)
+ * :param ofs: Offset within the EEPROM to start writing at
+ * :param buf: Data to write
+ * :param len: Number of bytes to write
+ * :return: EEPROM_OK on success, otherwise the failure reason
+ */
+enum eeprom_status eeprom_write(const struct eeprom_type *type, uint8_t addr,
+		uint32_t ofs, const uint8_t *buf, int len)
+{
+	enum eeprom_status status;
+	int chunk;
+
+	if (len < 0 || !eeprom_range_ok(type, ofs, len))
+		return EEPROM_RANGE;
+
+	while (len > 0) {
+		chunk = type->page_size - (ofs % type->page_size);
+		if (chunk > len)
+			chunk = len;
+
+		status = eeprom_write_page(type, addr, ofs, buf, chunk);
+		if (status != EEPROM_OK)
+			return status;
+
+		ofs += chunk;
+		buf += chunk;
+		len -= chunk;
+	}
+
+	return EEPROM_OK;
+}
+
+/**
+ * Reads back a range of the EEPROM and compares it to the supplied data.
+ *
+ * :return: EEPROM_OK if the contents match, otherwise the failure reason
+ */
+enum eeprom_status eeprom_verify(const struct eeprom_type *type, uint8_t addr,
+		uint32_t ofs, const uint8_t *buf, int len)
+{
+	enum eeprom_status status;
+	uint8_t data[32];
+	int chunk;
+
+	while (len > 0) {
+		chunk = (len > (int) sizeof(data)) ? (int) sizeof(data) : len;
+
+		status = eeprom_read(type, addr, ofs, data, chunk);
+		if (status != EEPROM_OK)
+			return status;
+		if (memcmp(data, buf, chunk) != 0)
+			return EEPROM_VERIFY_FAIL;
+
+		ofs += chunk;
+		buf += chunk;
+		len -= chunk;
+	}
+
+	return EEPROM_OK;
+}
+
+/* Avoid dynamic allocations */
+static struct eeprom_prog static_prog;
+
+/**
+ * Starts a streaming program operation. Data is then supplied in arbitrary
+ * sized pieces via eeprom_prog_data(), which writes and verifies each page
+ * as soon as it has been filled.
+ *
+ * :param type: Geometry of the device
+ * :param addr: Base 7-bit I2C address of the device (usually 0x50)
+ * :param ofs: Offset within the EEPROM to start writing at
+ * :param len: Total number of bytes that will be programmed
+ * :return: The program context to pass to subsequent calls
+ */
+struct eeprom_prog *eeprom_prog_start(const struct eeprom_type *type,
+		uint8_t addr, uint32_t ofs, uint32_t len)
+{
+	struct eeprom_prog *prog = &static_prog;
+
+	prog->type = type;
+	prog->addr = addr;
+	prog->ofs = ofs;
+	prog->end = ofs + len;
+	prog->fill = 0;
+	prog->crc = 0;
+	prog->status = eeprom_range_ok(type, ofs, len) ?
+		EEPROM_OK : EEPROM_RANGE;
+
+	return prog;
+}
+
+static void eeprom_prog_flush(struct eeprom_prog *prog)
+{
+	prog->status = eeprom_write_page(prog->type, prog->addr, prog->ofs,
+			prog->page, prog->fill);
+	if (prog->status == EEPROM_OK)
+		prog->status = eeprom_verify(prog->type, prog->addr,
+				prog->ofs, prog->page, prog->fill);
+	if (prog->status == EEPROM_OK)
+		prog->crc = crc16_arc(prog->crc, prog->page, prog->fill);
+
+	prog->ofs += prog->fill;
+	prog->fill = 0;
+}
+
+/**
+ * Supplies the next piece of data for a streaming program operation. Once an
+ * error has occurred further data is discarded.
+ *
+ * :return: EEPROM_OK if everything so far has been written and verified,
+ *          otherwise the failure reason
+ */
+enum eeprom_status eeprom_prog_data(struct eeprom_prog *prog,
+		const uint8_t *buf, int len)
+{
+	uint32_t pagelen;
+	int chunk;
+
+	while (len > 0 && prog->status == EEPROM_OK) {
+		if (prog->ofs + prog->fill >= prog->end) {
+			/* More data than we were told to expect */
+			prog->status = EEPROM_RANGE;
+			break;
+		}
+
+		/* Bytes to the end of this page, or the end of the range */
+		pagelen = prog->type->page_size -
+			(prog->ofs % prog->type->page_size);
+		if (pagelen > prog->end - prog->ofs)
+			pagelen = prog->end - prog->ofs;
+
+		chunk = pagelen - prog->fill;
+		if (chunk > len)
+			chunk = len;
+
+		memcpy(&prog->page[prog->fill], buf, chunk);
+		prog->fill += chunk;
+		buf += chunk;
+		len -= chunk;
+
+		if (prog->fill == pagelen)
+			eeprom_prog_flush(prog);
+	}
+
+	return prog->status;
+}
+
+/**
+ * Completes a streaming program operation.
+ *
+ * :param crc: Set to the CRC-16/ARC of the data written and verified
+ * :return: EEPROM_OK if the whole range was written and verified,
+ *          otherwise the failure reason
+ */
+enum eeprom_status eeprom_prog_finish(struct eeprom_prog *prog,
+		uint16_t *crc)
+{
+	/* Cope with being given less data than expected */
+	if (prog->status == EEPROM_OK && prog->fill > 0)
+		eeprom_prog_flush(prog);
+
+	*crc = prog->crc;
+
+	return prog->status;
+}
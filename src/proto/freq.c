@@ -0,0 +1,124 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ * Frequency / pulse width measurement on the AUX pin
+ *
+ * Timestamps every edge on AUX using input capture (see icap-*.c) for the
+ * gate time and accumulates period, high and low pulse width statistics as
+ * it goes, so there's nothing to store and only the summary needs to go to
+ * the host.
+ *
+ * Copyright 2021 Jonathan McDowell <noodles@earth.li>
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "dwt.h"
+#include "freq.h"
+#include "icap.h"
+
+static void freq_add(struct freq_pulses *p, uint32_t len)
+{
+	uint32_t us = len / MHZ;
+	int bin = 0;
+
+	while (us && bin < FREQ_HIST_BINS - 1) {
+		us >>= 1;
+		bin++;
+	}
+
+	p->count++;
+	p->sum += len;
+	if (len < p->min)
+		p->min = len;
+	if (len > p->max)
+		p->max = len;
+	p->hist[bin]++;
+}
+
+/**
+ * Measures the signal on AUX for the given gate time. AUX is left as an
+ * input.
+ *
+ * :param gate_ms: Gate time in ms, clipped to FREQ_MAX_GATE_MS
+ * :param res: Filled in with the measurements
+ */
+void freq_measure(uint32_t gate_ms, struct freq_result *res)
+{
+	struct icap_edge edge;
+	uint32_t end, missed, last, last_rise;
+	bool have_last, have_rise, last_rising;
+
+	if (gate_ms > FREQ_MAX_GATE_MS)
+		gate_ms = FREQ_MAX_GATE_MS;
+
+	memset(res, 0, sizeof(*res));
+	res->period.min = res->high.min = res->low.min = UINT32_MAX;
+
+	missed = last = last_rise = 0;
+	have_last = have_rise = last_rising = false;
+
+	icap_start();
+	end = dwt_cycles() + gate_ms * 1000 * MHZ;
+	while ((int32_t) (end - dwt_cycles()) > 0) {
+		if (!icap_next(&edge))
+			continue;
+		res->edges++;
+
+		/* Don't measure across edges we lost */
+		if (icap_missed() != missed) {
+			missed = icap_missed();
+			have_last = have_rise = false;
+		}
+
+		if (have_last && edge.rising != last_rising)
+			freq_add(edge.rising ? &res->low : &res->high,
+					edge.t - last);
+		if (edge.rising) {
+			if (have_rise)
+				freq_add(&res->period, edge.t - last_rise);
+			last_rise = edge.t;
+			have_rise = true;
+		}
+
+		last = edge.t;
+		last_rising = edge.rising;
+		have_last = true;
+	}
+	icap_stop();
+
+	res->missed = missed;
+	if (res->period.count == 0)
+		res->period.min = 0;
+	if (res->high.count == 0)
+		res->high.min = 0;
+	if (res->low.count == 0)
+		res->low.min = 0;
+}
+
+/**
+ * :return: The average frequency in mHz, or 0 if no complete periods were
+ *          measured
+ */
+uint32_t freq_millihz(const struct freq_result *res)
+{
+	if (res->period.sum == 0)
+		return 0;
+
+	return (uint64_t) res->period.count * MHZ * 1000000000 /
+		res->period.sum;
+}
+
+/**
+ * :return: The proportion of time the signal was high, in tenths of a
+ *          percent, or 0 if no complete pulses were measured
+ */
+uint32_t freq_duty_permille(const struct freq_result *res)
+{
+	uint64_t total = (uint64_t) res->high.sum + res->low.sum;
+
+	if (total == 0)
+		return 0;
+
+	return (uint64_t) res->high.sum * 1000 / total;
+}
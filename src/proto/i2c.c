@@ -7,6 +7,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <chopstx.h>
 
@@ -14,9 +15,38 @@
 #include "gpio.h"
 #include "i2c.h"
 #include "intr.h"
+#include "trigger.h"
 
 static uint8_t i2c_scl, i2c_sda, i2c_speed;
 
+/*
+ * Longest the monitor keeps interrupts off for, so USB keeps being serviced
+ * under continuous traffic
+ */
+#define I2C_MON_MAX_US	20000
+
+/* Sample bits fed to the monitor trigger */
+#define I2C_TRIG_SCL	0x01
+#define I2C_TRIG_SDA	0x02
+
+/* Decoder state for the passive bus monitor */
+static struct {
+	/* Last sampled SCL/SDA state */
+	uint32_t last;
+	/* Records dropped due to lack of buffer space, and last reported */
+	uint32_t dropped, reported;
+	uint8_t shift;
+	uint8_t bits;
+	/* True between a start condition and the following stop */
+	bool synced;
+	/* We returned mid transaction, so edges were missed */
+	bool lost;
+	/* Optional trigger; records are only kept once it fires */
+	struct trigger trig;
+	bool triggered;
+	uint16_t word;
+} i2c_mon;
+
 void i2c_start(void)
 {
 	__disable_irq();
@@ -43,11 +73,14 @@ void i2c_stop(void)
 	__enable_irq();
 }
 
-bool i2c_read_bit(void)
+/*
+ * Clock a single bit in from the bus. Must be called with interrupts
+ * disabled.
+ */
+static bool i2c_clock_in(void)
 {
 	bool bit;
 
-	__disable_irq();
 	/* SDA pulled high by pullup, allows slave to pull low */
 	gpio_set(i2c_sda, true);
 
@@ -59,14 +92,16 @@ bool i2c_read_bit(void)
 	bit = gpio_get(i2c_sda);
 
 	gpio_set(i2c_scl, false);
-	__enable_irq();
 
 	return bit;
 }
 
-void i2c_write_bit(bool bit)
+/*
+ * Clock a single bit out onto the bus. Must be called with interrupts
+ * disabled.
+ */
+static void i2c_clock_out(bool bit)
 {
-	__disable_irq();
 	gpio_set(i2c_sda, bit);
 
 	dwt_delay(i2c_speed);
@@ -74,35 +109,402 @@ void i2c_write_bit(bool bit)
 	dwt_delay(i2c_speed);
 	// TODO: Clock stretching
 	gpio_set(i2c_scl, false);
-	__enable_irq();
 }
 
-uint8_t i2c_read(void)
+/*
+ * Clock a byte out followed by reading the (n)ack bit, all within a single
+ * critical section.
+ *
+ * :return: True if the byte was NACKed
+ */
+static bool i2c_write_byte(uint8_t val)
 {
+	bool nack;
 	int i;
+
+	__disable_irq();
+#pragma GCC unroll 8
+	for (i = 0; i < 8; i++) {
+		i2c_clock_out(val & 0x80);
+		val <<= 1;
+	}
+	nack = i2c_clock_in();
+	__enable_irq();
+
+	return nack;
+}
+
+/*
+ * Clock a byte in, optionally followed by sending an ACK (false) or NACK
+ * (true), all within a single critical section.
+ */
+static uint8_t i2c_read_byte(bool send_ack, bool nack)
+{
 	uint8_t val;
+	int i;
 
 	val = 0;
+	__disable_irq();
+#pragma GCC unroll 8
 	for (i = 0; i < 8; i++) {
 		val <<= 1;
-		if (i2c_read_bit())
+		if (i2c_clock_in())
 			val |= 1;
 	}
+	if (send_ack)
+		i2c_clock_out(nack);
+	__enable_irq();
 
 	return val;
 }
 
+bool i2c_read_bit(void)
+{
+	bool bit;
+
+	__disable_irq();
+	bit = i2c_clock_in();
+	__enable_irq();
+
+	return bit;
+}
+
+void i2c_write_bit(bool bit)
+{
+	__disable_irq();
+	i2c_clock_out(bit);
+	__enable_irq();
+}
+
+uint8_t i2c_read(void)
+{
+	return i2c_read_byte(false, false);
+}
+
 bool i2c_write(uint8_t val)
+{
+	/* Write and return (n)ack */
+	return i2c_write_byte(val);
+}
+
+/**
+ * Writes a buffer of bytes to the I2C bus, checking for an ACK after each
+ * one. Does not issue a start or stop condition.
+ *
+ * :param buf: Data to write
+ * :param len: Number of bytes to write
+ * :param ignore_nack: True if we should keep writing after a NACK, false to
+ *                     stop at the first NACKed byte.
+ * :return: The number of bytes that were ACKed
+ */
+int i2c_write_buf(const uint8_t *buf, int len, bool ignore_nack)
+{
+	int i, acked;
+
+	acked = 0;
+	for (i = 0; i < len; i++) {
+		if (!i2c_write_byte(buf[i]))
+			acked++;
+		else if (!ignore_nack)
+			break;
+	}
+
+	return acked;
+}
+
+/**
+ * Reads a buffer of bytes from the I2C bus, ACKing every byte but the last.
+ * Does not issue a start or stop condition.
+ *
+ * :param buf: Buffer to store the read data in
+ * :param len: Number of bytes to read
+ * :param policy: What to do after the last byte; I2C_ACK_ALL ACKs it (more
+ *                data to follow), I2C_NACK_LAST NACKs it (end of transfer)
+ *                and I2C_ACK_DEFER leaves the (n)ack for the caller to send.
+ */
+void i2c_read_buf(uint8_t *buf, int len, enum i2c_ack_policy policy)
 {
 	int i;
 
-	for (i = 0; i < 8; i++) {
-		i2c_write_bit(val & 0x80);
-		val <<= 1;
+	if (len <= 0)
+		return;
+
+	for (i = 0; i < len - 1; i++)
+		buf[i] = i2c_read_byte(true, false);
+
+	buf[i] = i2c_read_byte(policy != I2C_ACK_DEFER,
+			policy == I2C_NACK_LAST);
+}
+
+/**
+ * Performs a complete combined I2C transaction; a write phase followed by a
+ * repeated start and a read phase. Typically used to write a register
+ * address and then read back its contents. Either phase may be skipped by
+ * passing a 0 length.
+ *
+ * :param addr: 7-bit address of the target device
+ * :param wbuf: Data to write (e.g. register address)
+ * :param wlen: Number of bytes to write
+ * :param rbuf: Buffer to store data read from the device
+ * :param rlen: Number of bytes to read
+ * :return: True if the device ACKed the transaction, false otherwise
+ */
+bool i2c_xfer(uint8_t addr, const uint8_t *wbuf, int wlen,
+		uint8_t *rbuf, int rlen)
+{
+	bool ok = true;
+
+	if (wlen > 0 || rlen == 0) {
+		i2c_start();
+		ok = !i2c_write_byte(addr << 1) &&
+			i2c_write_buf(wbuf, wlen, false) == wlen;
+	}
+
+	if (ok && rlen > 0) {
+		i2c_start();
+		ok = !i2c_write_byte(addr << 1 | 1);
+		if (ok)
+			i2c_read_buf(rbuf, rlen, I2C_NACK_LAST);
+	}
+
+	i2c_stop();
+
+	return ok;
+}
+
+/**
+ * Probes every 7-bit address on the bus and records which ones ACK.
+ *
+ * Quick write probes send just the address with the write bit set (SMBus
+ * "quick command"), which some parts treat as the start of a write. Read
+ * probes set the read bit instead, and NACK the first returned byte so
+ * the device releases the bus. I2C_SCAN_AUTO uses read probes for the
+ * EEPROM (0x50-0x5F) and 0x30-0x37 ranges, as i2cdetect does, and quick
+ * writes elsewhere.
+ *
+ * Probes run at the currently configured bus speed; use i2c_set_speed()
+ * first to scan faster.
+ *
+ * :param bitmap: 16 byte buffer to store the results in. Bit (addr & 7) of
+ *                byte (addr >> 3) is set if addr ACKed.
+ * :param mode: Which probe type to use
+ */
+void i2c_scan(uint8_t bitmap[16], enum i2c_scan_mode mode)
+{
+	uint8_t addr;
+	bool ack, read;
+
+	memset(bitmap, 0, 16);
+
+	for (addr = 0; addr < 128; addr++) {
+		if (mode == I2C_SCAN_AUTO)
+			read = (addr >= 0x30 && addr <= 0x37) ||
+				(addr >= 0x50 && addr <= 0x5F);
+		else
+			read = (mode == I2C_SCAN_READ);
+
+		i2c_start();
+		ack = !i2c_write_byte(addr << 1 | read);
+		if (ack && read)
+			i2c_read_byte(true, true);
+		i2c_stop();
+
+		if (ack)
+			bitmap[addr >> 3] |= 1 << (addr & 7);
+	}
+}
+
+/**
+ * Puts the I2C pins into passive monitor mode; both are left as inputs so
+ * we only observe traffic between other devices. Uses the pins configured
+ * by i2c_init().
+ */
+void i2c_monitor_start(void)
+{
+	gpio_set_input(i2c_scl);
+	gpio_set_input(i2c_sda);
+
+	memset(&i2c_mon, 0, sizeof(i2c_mon));
+	i2c_mon.last = gpio_port_get(i2c_scl) &
+		(GPIO_MASK(i2c_scl) | GPIO_MASK(i2c_sda));
+	i2c_mon.triggered = true;
+}
+
+/**
+ * Only start keeping monitor records once a transaction to the given
+ * address is seen; that transaction's start is kept as the pre-trigger
+ * window. Call after i2c_monitor_start().
+ *
+ * :param addr: Address byte (7-bit address << 1 | R/W) to trigger on
+ * :param mask: Bits of the address byte to match; 0xFE for either direction
+ */
+void i2c_monitor_trigger(uint8_t addr, uint8_t mask)
+{
+	trigger_init(&i2c_mon.trig);
+	trigger_add_i2c_addr(&i2c_mon.trig, I2C_TRIG_SCL, I2C_TRIG_SDA, addr,
+			mask);
+	trigger_arm(&i2c_mon.trig);
+	i2c_mon.triggered = false;
+}
+
+static int i2c_monitor_record(uint8_t *buf, int pos, int size, uint8_t type,
+		uint8_t data, uint32_t ts)
+{
+	if (pos + I2C_MON_RECLEN > size) {
+		i2c_mon.dropped++;
+		return pos;
 	}
 
-	/* Read and return (n)ack */
-	return i2c_read_bit();
+	buf[pos++] = type;
+	buf[pos++] = data;
+	buf[pos++] = ts & 0xFF;
+	buf[pos++] = (ts >> 8) & 0xFF;
+	buf[pos++] = (ts >> 16) & 0xFF;
+	buf[pos++] = (ts >> 24) & 0xFF;
+
+	return pos;
+}
+
+/**
+ * Decodes bus traffic from SCL/SDA edges into a buffer of I2C_MON_RECLEN
+ * byte records. Interrupts are disabled while sampling so that no edges are
+ * missed; the caller drains the buffer between calls.
+ *
+ * Returns once the bus has been idle (no edges) for idle_us, at the first
+ * stop condition after the buffer is half full, or after 20ms regardless,
+ * so idle_us should be less than that. If the buffer fills
+ * mid-transaction decoding continues, with further records counted as
+ * dropped and reported with an I2C_MON_OVERFLOW record on the next call.
+ *
+ * :param buf: Buffer to store records in
+ * :param size: Size of the buffer
+ * :param idle_us: How long the bus must be quiet before returning
+ * :return: Number of bytes of records stored in buf
+ */
+int i2c_monitor_capture(uint8_t *buf, int size, uint32_t idle_us)
+{
+	uint32_t scl = GPIO_MASK(i2c_scl);
+	uint32_t sda = GPIO_MASK(i2c_sda);
+	uint32_t idle = idle_us * MHZ;
+	uint32_t cur, prev, now, last_edge, deadline;
+	uint8_t type;
+	int pos, window;
+
+	pos = 0;
+	if (i2c_mon.dropped != i2c_mon.reported) {
+		pos = i2c_monitor_record(buf, pos, size, I2C_MON_OVERFLOW, 0,
+				i2c_mon.dropped);
+		i2c_mon.reported = i2c_mon.dropped;
+	}
+	window = pos;
+
+	__disable_irq();
+	prev = gpio_port_get(i2c_scl) & (scl | sda);
+	last_edge = dwt_cycles();
+	deadline = last_edge + I2C_MON_MAX_US * MHZ;
+
+	/* We left a transaction unfinished, or the lines changed while away */
+	if (i2c_mon.lost || prev != i2c_mon.last) {
+		pos = i2c_monitor_record(buf, pos, size, I2C_MON_RESYNC, 0,
+				last_edge);
+		i2c_mon.lost = false;
+	}
+
+	while (1) {
+		cur = gpio_port_get(i2c_scl) & (scl | sda);
+		now = dwt_cycles();
+
+		if ((int32_t) (now - deadline) >= 0)
+			break;
+		if (cur == prev) {
+			if ((now - last_edge) >= idle)
+				break;
+			continue;
+		}
+		last_edge = now;
+
+		type = 0;
+		if ((cur ^ prev) & scl) {
+			/* Data is sampled on the rising clock edge */
+			if (cur & scl) {
+				if (i2c_mon.bits < 8) {
+					i2c_mon.shift <<= 1;
+					if (cur & sda)
+						i2c_mon.shift |= 1;
+					i2c_mon.bits++;
+				} else {
+					type = (cur & sda) ?
+						I2C_MON_NACK : I2C_MON_ACK;
+					i2c_mon.bits = 0;
+				}
+			}
+		} else if (cur & scl) {
+			/* SDA changing while SCL is high; start or stop */
+			type = (cur & sda) ? I2C_MON_STOP : I2C_MON_START;
+			i2c_mon.bits = 0;
+			if (type == I2C_MON_START)
+				i2c_mon.synced = true;
+		}
+		prev = cur;
+
+		if (!i2c_mon.triggered) {
+			/* Drop the previous transaction if it didn't match */
+			if (type == I2C_MON_START)
+				pos = window;
+			i2c_mon.word = (i2c_mon.word << 8) |
+				((cur & scl) ? I2C_TRIG_SCL : 0) |
+				((cur & sda) ? I2C_TRIG_SDA : 0);
+			i2c_mon.triggered = trigger_sample(&i2c_mon.trig,
+					i2c_mon.word);
+		}
+
+		if (type && i2c_mon.synced)
+			pos = i2c_monitor_record(buf, pos, size, type,
+					i2c_mon.shift, now);
+		if (type == I2C_MON_STOP)
+			i2c_mon.synced = false;
+
+		/* Give the caller a chance to drain the buffer */
+		if (type == I2C_MON_STOP && pos >= size / 2)
+			break;
+	}
+
+	/*
+	 * Anything could happen on the bus before we're next called, even
+	 * without the lines ending up different, so start again at the next
+	 * start condition.
+	 */
+	if (i2c_mon.synced)
+		i2c_mon.lost = true;
+	i2c_mon.synced = false;
+	i2c_mon.bits = 0;
+	i2c_mon.last = prev;
+	__enable_irq();
+
+	/* Nothing worth keeping yet */
+	if (!i2c_mon.triggered)
+		pos = window;
+
+	return pos;
+}
+
+/**
+ * :return: The total number of monitor records dropped due to lack of
+ *          buffer space since i2c_monitor_start()
+ */
+uint32_t i2c_monitor_dropped(void)
+{
+	return i2c_mon.dropped;
+}
+
+/**
+ * Sets the I2C bus speed.
+ *
+ * :param speed: Half clock period in µs; one of the I2C_SPEED_* values
+ */
+void i2c_set_speed(uint8_t speed)
+{
+	i2c_speed = speed;
 }
 
 /**
@@ -128,7 +530,7 @@ void i2c_init(uint8_t scl, uint8_t sda)
 {
 	i2c_scl = scl;
 	i2c_sda = sda;
-	i2c_speed = 5; /* 100kHz */
+	i2c_speed = I2C_SPEED_100KHZ;
 	gpio_set_output(scl, true);
 	gpio_set_output(sda, true);
 }
@@ -0,0 +1,374 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ * Logic analyser sampling engine
+ *
+ * Samples the port with the probe pins on at a fixed rate into a ring
+ * buffer, until the trigger (see trigger.c) has fired and the post trigger
+ * samples have been taken, so only those and the pre-trigger window that
+ * fits in the rest of the buffer get sent. Sample timing uses accumulated
+ * DWT deadlines, so an interrupt makes a sample late but doesn't shift the
+ * ones after it.
+ *
+ * Copyright 2021 Jonathan McDowell <noodles@earth.li>
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "dwt.h"
+#include "gpio.h"
+#include "la.h"
+
+#ifdef GNU_LINUX_EMULATION
+/* Emulated pins are the bottom bits of the port */
+#define LA_PORT_SHIFT	0
+
+static uint8_t la_buf[256 * 1024];
+#define LA_BUF		la_buf
+#define LA_BUF_SIZE	sizeof(la_buf)
+#else
+/* Probe pins are all in PB8-PB15 */
+#define LA_PORT_SHIFT	8
+
+/*
+ * Nothing else uses the heap, so we get all the RAM left after the stacks,
+ * data and BSS.
+ */
+extern uint8_t __heap_base__[], __heap_end__[];
+#define LA_BUF		__heap_base__
+#define LA_BUF_SIZE	((uint32_t) (__heap_end__ - __heap_base__))
+#endif
+
+/* Size of the packets the stream is built in; a full speed USB packet */
+#define LA_STREAM_PKT	64
+/* Longest record: type byte + 5 byte varint */
+#define LA_REC_MAX	6
+/* Send a state record at least this often, so deltas fit in 32 bits */
+#define LA_STREAM_IDLE	(1UL << 30)
+
+#define LA_STREAM_MASK	(GPIO_MASK(PIN_AUX) | GPIO_MASK(PIN_MOSI) | \
+			 GPIO_MASK(PIN_CLK) | GPIO_MASK(PIN_MISO) | \
+			 GPIO_MASK(PIN_CS))
+
+/* Avoid dynamic allocations */
+static struct la_state {
+	/* Configuration */
+	uint32_t period;
+	uint32_t size;
+	uint32_t post;
+	struct trigger *trig;
+
+	/* Capture progress */
+	uint32_t t;
+	uint16_t word;
+	uint32_t head;
+	uint32_t count;
+	uint32_t left;
+	bool triggered;
+} la_state;
+
+/**
+ * :return: The largest number of samples a capture can keep
+ */
+uint32_t la_max_samples(void)
+{
+	return LA_BUF_SIZE;
+}
+
+/**
+ * Sets up a new capture. Sampling doesn't start until la_run() is called.
+ *
+ * :param cfg: Capture configuration
+ */
+void la_start(const struct la_config *cfg)
+{
+	struct la_state *la = &la_state;
+
+	la->period = (cfg->rate >= LA_MAX_RATE) ? 0 :
+		(uint32_t) ((uint64_t) MHZ * 1000000 / cfg->rate);
+	la->size = cfg->samples;
+	if (la->size > LA_BUF_SIZE)
+		la->size = LA_BUF_SIZE;
+	if (la->size == 0)
+		la->size = 1;
+	la->post = cfg->post;
+	if (la->post > la->size)
+		la->post = la->size;
+	if (la->post == 0)
+		la->post = 1;
+	la->trig = cfg->trig;
+	if (la->trig)
+		trigger_arm(la->trig);
+
+	la->head = 0;
+	la->count = 0;
+	la->left = la->post;
+	la->triggered = (la->trig == NULL);
+	la->t = dwt_cycles();
+	la->word = (gpio_port_get(PIN_AUX) >> LA_PORT_SHIFT) & 0xFF;
+}
+
+/**
+ * Takes up to the given number of samples, returning early if the capture
+ * completes. Callers should keep the number of samples down to a few ms
+ * worth so they can check for the host wanting to abort.
+ *
+ * :param samples: Maximum number of samples to take
+ * :return: True if the capture is complete, false if more is to do
+ */
+bool la_run(uint32_t samples)
+{
+	struct la_state *la = &la_state;
+	uint8_t *buf = LA_BUF;
+	uint8_t s;
+
+	while (samples--) {
+		la->t += la->period;
+		dwt_wait_until(la->t);
+		s = gpio_port_get(PIN_AUX) >> LA_PORT_SHIFT;
+
+		buf[la->head] = s;
+		if (++la->head == la->size)
+			la->head = 0;
+		if (la->count < la->size)
+			la->count++;
+
+		if (!la->triggered) {
+			la->word = (la->word << 8) | s;
+			if (!trigger_sample(la->trig, la->word))
+				continue;
+			la->triggered = true;
+		}
+		if (--la->left == 0)
+			return true;
+	}
+
+	return false;
+}
+
+/**
+ * :return: The number of valid samples in the buffer
+ */
+uint32_t la_count(void)
+{
+	return la_state.count;
+}
+
+/**
+ * Retrieves a captured sample, newest first.
+ *
+ * :param n: Sample index; 0 is the most recent
+ * :return: The sample, or 0 if we don't have that many
+ */
+uint8_t la_get(uint32_t n)
+{
+	struct la_state *la = &la_state;
+	uint8_t *buf = LA_BUF;
+	uint32_t idx;
+
+	if (n >= la->count)
+		return 0;
+
+	idx = (la->head >= n + 1) ? la->head - n - 1 :
+		la->head + la->size - n - 1;
+
+	return buf[idx];
+}
+
+/*
+ * Streaming capture state. Records are built into a pair of packets; one is
+ * filled while the other waits for the endpoint. Packets prod_pkt - 1 back to
+ * cons_pkt are complete, and prod_pkt is being filled unless both are
+ * complete, in which case transitions are dropped until one is released.
+ */
+static struct la_stream {
+	uint8_t pkt[2][LA_STREAM_PKT];
+	int len[2];
+	uint32_t prod_pkt;
+	uint32_t cons_pkt;
+
+	uint32_t port;
+	uint32_t t;
+	uint32_t dropped;
+} la_stream;
+
+static uint8_t la_stream_pins(uint32_t port)
+{
+	return ((port & GPIO_MASK(PIN_AUX)) ? LA_PIN_AUX : 0) |
+		((port & GPIO_MASK(PIN_MOSI)) ? LA_PIN_MOSI : 0) |
+		((port & GPIO_MASK(PIN_CLK)) ? LA_PIN_CLK : 0) |
+		((port & GPIO_MASK(PIN_MISO)) ? LA_PIN_MISO : 0) |
+		((port & GPIO_MASK(PIN_CS)) ? LA_PIN_CS : 0);
+}
+
+/*
+ * Appends a record to the packet being filled, completing the packet if
+ * another record might not fit.
+ *
+ * :return: False if there's no packet to fill
+ */
+static bool la_stream_rec(uint8_t type, bool has_val, uint32_t val)
+{
+	struct la_stream *st = &la_stream;
+	uint8_t *pkt;
+	int *len;
+
+	if (st->prod_pkt - st->cons_pkt == 2)
+		return false;
+
+	pkt = st->pkt[st->prod_pkt & 1];
+	len = &st->len[st->prod_pkt & 1];
+
+	pkt[(*len)++] = type;
+	if (has_val) {
+		while (val > 0x7F) {
+			pkt[(*len)++] = 0x80 | (val & 0x7F);
+			val >>= 7;
+		}
+		pkt[(*len)++] = val;
+	}
+
+	if (*len > LA_STREAM_PKT - LA_REC_MAX) {
+		st->prod_pkt++;
+		if (st->prod_pkt - st->cons_pkt < 2)
+			st->len[st->prod_pkt & 1] = 0;
+	}
+
+	return true;
+}
+
+static bool la_stream_state(uint32_t now)
+{
+	struct la_stream *st = &la_stream;
+
+	if (!la_stream_rec(la_stream_pins(st->port), true, now - st->t))
+		return false;
+	st->t = now;
+
+	return true;
+}
+
+/**
+ * Starts a streaming capture of transitions on the probe pins, queueing the
+ * clock and initial pin state records.
+ */
+void la_stream_start(void)
+{
+	struct la_stream *st = &la_stream;
+
+	st->prod_pkt = st->cons_pkt = 0;
+	st->len[0] = 0;
+	st->dropped = 0;
+
+	la_stream_rec(LA_REC_CLOCK, true, MHZ * 1000000);
+	st->port = gpio_port_get(PIN_AUX) & LA_STREAM_MASK;
+	st->t = dwt_cycles();
+	la_stream_state(st->t);
+}
+
+/**
+ * Watches for transitions for up to the given time, returning early if a
+ * packet completes. Transitions are timestamped when we see them, so the
+ * resolution is the time round the loop.
+ *
+ * :param usec: Maximum time to sample for, in µs
+ * :return: True if there's a complete packet waiting
+ */
+bool la_stream_run(uint32_t usec)
+{
+	struct la_stream *st = &la_stream;
+	uint32_t deadline, now, port, prod;
+
+	prod = st->prod_pkt;
+	deadline = dwt_cycles() + usec * MHZ;
+	do {
+		port = gpio_port_get(PIN_AUX) & LA_STREAM_MASK;
+		now = dwt_cycles();
+
+		if (port != st->port) {
+			st->port = port;
+			if (!la_stream_state(now))
+				st->dropped++;
+		} else if (now - st->t >= LA_STREAM_IDLE) {
+			la_stream_state(now);
+		}
+
+		if (st->prod_pkt != prod)
+			return true;
+	} while ((int32_t) (deadline - now) > 0);
+
+	return st->prod_pkt != st->cons_pkt;
+}
+
+/**
+ * Completes the packet being filled, if it has anything in it, so slow
+ * signals still make it to the host promptly.
+ */
+void la_stream_flush(void)
+{
+	struct la_stream *st = &la_stream;
+
+	if (st->prod_pkt - st->cons_pkt == 2 ||
+			st->len[st->prod_pkt & 1] == 0)
+		return;
+
+	st->prod_pkt++;
+	if (st->prod_pkt - st->cons_pkt < 2)
+		st->len[st->prod_pkt & 1] = 0;
+}
+
+/**
+ * Ends the capture, queueing an end record. If both packets are waiting to
+ * be sent this fails, and should be retried after la_stream_release().
+ *
+ * :return: True if the end record was queued
+ */
+bool la_stream_stop(void)
+{
+	if (!la_stream_rec(LA_REC_END, false, 0))
+		return false;
+	la_stream_flush();
+
+	return true;
+}
+
+/**
+ * Returns the oldest complete packet, which stays valid until
+ * la_stream_release() is called.
+ *
+ * :param len: Set to the length of the packet
+ * :return: The packet, or NULL if there are none
+ */
+const uint8_t *la_stream_packet(int *len)
+{
+	struct la_stream *st = &la_stream;
+
+	if (st->prod_pkt == st->cons_pkt)
+		return NULL;
+
+	*len = st->len[st->cons_pkt & 1];
+
+	return st->pkt[st->cons_pkt & 1];
+}
+
+/**
+ * Releases the oldest complete packet once it's been sent. If we were
+ * dropping transitions this reports how many and resyncs the pin state.
+ */
+void la_stream_release(void)
+{
+	struct la_stream *st = &la_stream;
+	bool full;
+
+	full = (st->prod_pkt - st->cons_pkt == 2);
+	st->cons_pkt++;
+	if (!full)
+		return;
+
+	st->len[st->prod_pkt & 1] = 0;
+	if (st->dropped) {
+		la_stream_rec(LA_REC_OVERFLOW, true, st->dropped);
+		st->dropped = 0;
+		la_stream_state(dwt_cycles());
+	}
+}
@@ -0,0 +1,177 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ * Pattern generator
+ *
+ * Replays a stream of pin state vectors (in the bitbang 0x80 command
+ * layout) on the probe pins at a fixed rate. Vectors are queued in a ring
+ * buffer while earlier ones are output, and output doesn't start until the
+ * ring is full or holds the whole pattern. Output timing uses accumulated
+ * DWT deadlines, so time spent fetching the next USB packet makes a vector
+ * late but doesn't shift the ones after it.
+ *
+ * If the ring runs dry the pins hold their last state and we count an
+ * underrun; output resumes from when the next vector arrives.
+ *
+ * Copyright 2021 Jonathan McDowell <noodles@earth.li>
+ */
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "buspirate.h"
+#include "dwt.h"
+#include "gpio.h"
+#include "pattern.h"
+
+/* Must be a power of 2 */
+#define PATTERN_BUF_SIZE	2048
+
+/* Avoid dynamic allocations */
+static struct pattern_state {
+	uint8_t buf[PATTERN_BUF_SIZE];
+	/* Port set mask for each possible vector */
+	uint32_t port[32];
+	uint32_t mask;
+	uint32_t period;
+
+	/* Vectors queued (head) and output (tail), and how many we expect */
+	uint32_t head;
+	uint32_t tail;
+	uint32_t count;
+
+	uint32_t t;
+	uint32_t underruns;
+	bool started;
+	bool starved;
+} pattern_state;
+
+/**
+ * Sets up a new pattern. Nothing is output until enough vectors have been
+ * supplied via pattern_fill() and pattern_run() is called.
+ *
+ * :param rate: Vector output rate, in Hz
+ * :param count: Number of vectors in the pattern
+ * :return: False if the rate isn't supported, true otherwise
+ */
+bool pattern_start(uint32_t rate, uint32_t count)
+{
+	struct pattern_state *pat = &pattern_state;
+	int i;
+
+	if (rate == 0 || rate > PATTERN_MAX_RATE)
+		return false;
+
+	for (i = 0; i < 32; i++)
+		pat->port[i] = bp_state_port(i);
+	pat->mask = bp_state_port(0x1F);
+	pat->period = (uint32_t) ((uint64_t) MHZ * 1000000 / rate);
+
+	pat->head = pat->tail = 0;
+	pat->count = count;
+	pat->underruns = 0;
+	pat->started = false;
+	pat->starved = false;
+
+	return true;
+}
+
+/**
+ * :return: The number of vectors still to be supplied
+ */
+uint32_t pattern_wanted(void)
+{
+	return pattern_state.count - pattern_state.head;
+}
+
+/**
+ * Queues vectors for output.
+ *
+ * :param buf: Vectors to queue
+ * :param len: Number of vectors in buf
+ * :return: Number of vectors queued, which is less than len if the ring
+ *          buffer is full or the pattern is complete
+ */
+int pattern_fill(const uint8_t *buf, int len)
+{
+	struct pattern_state *pat = &pattern_state;
+	uint32_t space;
+	int i;
+
+	space = PATTERN_BUF_SIZE - (pat->head - pat->tail);
+	if ((uint32_t) len > space)
+		len = space;
+	if ((uint32_t) len > pat->count - pat->head)
+		len = pat->count - pat->head;
+
+	for (i = 0; i < len; i++)
+		pat->buf[(pat->head + i) & (PATTERN_BUF_SIZE - 1)] = buf[i];
+	pat->head += len;
+
+	if (!pat->started && (pat->head == pat->count ||
+			pat->head - pat->tail == PATTERN_BUF_SIZE)) {
+		pat->started = true;
+		pat->t = dwt_cycles();
+	}
+
+	return len;
+}
+
+/**
+ * Outputs queued vectors as they fall due, for up to the given time. Callers
+ * should keep this to a fraction of the time the ring buffer lasts, and
+ * refill it between calls.
+ *
+ * :param usec: Maximum time to output for, in µs
+ * :return: Whether we're busy, need more vectors or are done
+ */
+enum pattern_status pattern_run(uint32_t usec)
+{
+	struct pattern_state *pat = &pattern_state;
+	uint32_t deadline;
+
+	if (pat->tail == pat->count)
+		return PATTERN_DONE;
+	if (!pat->started)
+		return PATTERN_NEED_DATA;
+
+	if (pat->tail == pat->head) {
+		/* It's only an underrun once the next vector is due */
+		if (!pat->starved) {
+			if (dwt_cycles() - pat->t < pat->period)
+				return PATTERN_BUSY;
+			pat->starved = true;
+			pat->underruns++;
+		}
+		return PATTERN_NEED_DATA;
+	}
+
+	if (pat->starved) {
+		/* Carry on from now rather than trying to catch up */
+		pat->starved = false;
+		pat->t = dwt_cycles();
+	}
+
+	deadline = dwt_cycles() + usec * MHZ;
+	while (pat->tail != pat->head) {
+		/* Don't sit waiting for a slow vector past our time slot */
+		if ((int32_t) (pat->t + pat->period - deadline) > 0) {
+			dwt_wait_until(deadline);
+			break;
+		}
+
+		pat->t += pat->period;
+		dwt_wait_until(pat->t);
+		gpio_port_set(PIN_AUX, pat->port[pat->buf[pat->tail &
+				(PATTERN_BUF_SIZE - 1)] & 0x1F], pat->mask);
+		pat->tail++;
+	}
+
+	return (pat->tail == pat->count) ? PATTERN_DONE : PATTERN_BUSY;
+}
+
+/**
+ * :return: How many times the ring buffer ran dry during output
+ */
+uint32_t pattern_underruns(void)
+{
+	return pattern_state.underruns;
+}
@@ -0,0 +1,189 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ * Multi-stage trigger engine shared by the capture and monitor modes
+ *
+ * A trigger is a sequence of stages, each a mask compare on the previous +
+ * current sample that must hold for a number of samples in a row. Protocol
+ * level triggers are built from the same stages: an I2C address match is a
+ * start condition then a stage per SCL rising edge, checking SDA against
+ * the expected bit, and a 1-Wire reset is a long enough low followed by the
+ * rising edge at its end.
+ *
+ * Copyright 2021 Jonathan McDowell <noodles@earth.li>
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "trigger.h"
+
+/* Loads a stage into the fast path fields */
+static void trigger_load(struct trigger *t, int stage)
+{
+	t->cur = stage;
+	t->run = 0;
+	if (stage < t->stages) {
+		t->mask = t->stage[stage].mask;
+		t->value = t->stage[stage].value;
+		t->need = t->stage[stage].count;
+	} else {
+		/* No more stages; always matches */
+		t->mask = t->value = 0;
+		t->need = 0;
+	}
+}
+
+static struct trigger_stage *trigger_new_stage(struct trigger *t)
+{
+	struct trigger_stage *stage;
+
+	if (t->stages >= TRIGGER_MAX_STAGES)
+		return NULL;
+
+	stage = &t->stage[t->stages++];
+	memset(stage, 0, sizeof(*stage));
+	stage->count = 1;
+
+	return stage;
+}
+
+/**
+ * Clears a trigger. A trigger with no stages fires on the first sample.
+ */
+void trigger_init(struct trigger *t)
+{
+	t->stages = 0;
+	trigger_load(t, 0);
+}
+
+/**
+ * Adds a level / pattern stage.
+ *
+ * :param mask: Sample bits we care about
+ * :param value: Their required state
+ * :param count: Number of samples in a row the pattern must be seen for
+ * :return: False if there are too many stages
+ */
+bool trigger_add_pattern(struct trigger *t, uint8_t mask, uint8_t value,
+		uint32_t count)
+{
+	struct trigger_stage *stage = trigger_new_stage(t);
+
+	if (!stage)
+		return false;
+
+	stage->mask = TRIGGER_CUR(mask);
+	stage->value = TRIGGER_CUR(value & mask);
+	stage->count = count ? count : 1;
+
+	return true;
+}
+
+/**
+ * Adds an edge stage.
+ *
+ * :param bit: Sample bit to watch
+ * :param rising: True for a rising edge, false for falling
+ * :return: False if there are too many stages
+ */
+bool trigger_add_edge(struct trigger *t, uint8_t bit, bool rising)
+{
+	struct trigger_stage *stage = trigger_new_stage(t);
+
+	if (!stage)
+		return false;
+
+	stage->mask = TRIGGER_PREV(bit) | TRIGGER_CUR(bit);
+	stage->value = rising ? TRIGGER_CUR(bit) : TRIGGER_PREV(bit);
+
+	return true;
+}
+
+/**
+ * Adds stages matching an I2C start condition followed by the given address
+ * byte (7-bit address << 1 | R/W). A mismatched bit restarts the trigger.
+ * This uses 9 stages, so must come first.
+ *
+ * :param scl: Sample bit of SCL
+ * :param sda: Sample bit of SDA
+ * :param addr: Address byte to match
+ * :param mask: Bits of the address byte to match; e.g. 0xFE for either
+ *              direction
+ * :return: False if there are too many stages
+ */
+bool trigger_add_i2c_addr(struct trigger *t, uint8_t scl, uint8_t sda,
+		uint8_t addr, uint8_t mask)
+{
+	struct trigger_stage *stage;
+	int i;
+
+	if (t->stages + 9 > TRIGGER_MAX_STAGES)
+		return false;
+
+	/* Start: SDA falls while SCL is high */
+	stage = trigger_new_stage(t);
+	stage->mask = TRIGGER_PREV(scl | sda) | TRIGGER_CUR(scl | sda);
+	stage->value = TRIGGER_PREV(scl | sda) | TRIGGER_CUR(scl);
+
+	/* Then each address bit, msb first, sampled on SCL rising */
+	for (i = 7; i >= 0; i--) {
+		stage = trigger_new_stage(t);
+		stage->mask = TRIGGER_PREV(scl) | TRIGGER_CUR(scl);
+		stage->value = TRIGGER_CUR(scl);
+		stage->check = (mask & (1 << i)) ? TRIGGER_CUR(sda) : 0;
+		stage->expect = (addr & mask & (1 << i)) ? TRIGGER_CUR(sda) : 0;
+	}
+
+	return true;
+}
+
+/**
+ * Adds stages matching a 1-Wire reset pulse: the bus held low for at least
+ * count samples (the caller converts 480µs to samples), firing as it's
+ * released.
+ *
+ * :param bit: Sample bit of the 1-Wire bus
+ * :param count: Minimum length of the low pulse in samples
+ * :return: False if there are too many stages
+ */
+bool trigger_add_w1_reset(struct trigger *t, uint8_t bit, uint32_t count)
+{
+	if (t->stages + 2 > TRIGGER_MAX_STAGES)
+		return false;
+
+	trigger_add_pattern(t, bit, 0, count);
+	trigger_add_edge(t, bit, true);
+
+	return true;
+}
+
+/**
+ * Resets a trigger back to waiting for its first stage.
+ */
+void trigger_arm(struct trigger *t)
+{
+	trigger_load(t, 0);
+}
+
+/**
+ * Slow path of trigger_sample(), called when the current stage matches.
+ *
+ * :return: True if that was the final stage
+ */
+bool trigger_advance(struct trigger *t, uint16_t word)
+{
+	struct trigger_stage *stage;
+
+	if (t->cur >= t->stages)
+		return true;
+
+	stage = &t->stage[t->cur];
+	if ((word & stage->check) != stage->expect) {
+		trigger_load(t, 0);
+		return false;
+	}
+
+	trigger_load(t, t->cur + 1);
+
+	return t->cur >= t->stages;
+}
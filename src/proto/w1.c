@@ -21,8 +21,6 @@
 #include <stdlib.h>
 #include <string.h>
 
-#include <chopstx.h>
-
 #include "dwt.h"
 #include "gpio.h"
 #include "intr.h"
@@ -32,21 +30,79 @@
 
 static uint8_t w1_gpio;
 
-uint8_t w1_crc(uint8_t *buf, uint8_t len)
+/*
+ * Slot timings from Maxim Application Note 126, in DWT cycles.
+ *
+ * https://www.maximintegrated.com/en/design/technical-documents/app-notes/1/126.html
+ *
+ * Each phase is timed as a deadline from the start of the slot, so the time
+ * spent in the GPIO calls doesn't add to the slot length; this matters for
+ * the 1µs phases of overdrive at 72MHz.
+ */
+#define W1_NS(ns)	((uint32_t) (ns) * MHZ / 1000)
+
+static const struct w1_timing {
+	/* Write 1: low time (A), then release (B) */
+	uint32_t write1_low, write1_release;
+	/* Write 0: low time (C), then release (D) */
+	uint32_t write0_low, write0_release;
+	/* Read: low for A, release and sample after (E), recovery (F) */
+	uint32_t read_sample, read_release;
+	/* Reset: low time (H), presence sample (I), recovery (J) */
+	uint32_t reset_low, reset_presence, reset_release;
+	/* How late a critical edge or sample can be before it's an overrun */
+	uint32_t slack;
+} w1_timings[] = {
+	[W1_SPEED_STANDARD] = {
+		W1_NS(6000), W1_NS(64000),
+		W1_NS(60000), W1_NS(10000),
+		W1_NS(9000), W1_NS(55000),
+		W1_NS(480000), W1_NS(70000), W1_NS(410000),
+		W1_NS(2000),
+	},
+	[W1_SPEED_OVERDRIVE] = {
+		W1_NS(1000), W1_NS(7500),
+		W1_NS(7500), W1_NS(2500),
+		W1_NS(1000), W1_NS(7000),
+		W1_NS(70000), W1_NS(8500), W1_NS(40000),
+		W1_NS(500),
+	},
+};
+
+/*
+ * Waits longer than this at a slot boundary yield to other threads for most
+ * of the time, rather than spinning.
+ */
+#define W1_YIELD_US		100
+/* Time to allow for the scheduler to get back to us after yielding */
+#define W1_YIELD_MARGIN_US	20
+
+static const struct w1_timing *w1_timing = &w1_timings[W1_SPEED_STANDARD];
+static enum w1_speed w1_speed;
+static struct w1_stats w1_stats;
+
+/*
+ * Wait for a deadline at a slot boundary, where running late only makes the
+ * bus slower rather than breaking the protocol. Long waits yield for most
+ * of the period, then spin for the remainder.
+ */
+static void w1_wait_boundary(uint32_t deadline)
 {
-	uint8_t i, j, crc;
+	int32_t left = deadline - dwt_cycles();
 
-	crc = 0;
-	for (i = 0; i < len; i++)
-	{
-		crc ^= buf[i];
-		for (j = 0; j < 8; j++)
-		{
-			crc = crc >> 1 ^ ((crc & 1) ? 0x8c : 0);
-		}
-	}
+	if (left > (int32_t) (W1_YIELD_US * MHZ))
+		dwt_sleep(left / MHZ - W1_YIELD_MARGIN_US);
+
+	dwt_wait_until(deadline);
+}
 
-	return crc;
+/*
+ * Checks whether a critical point in a slot happened later than the timing
+ * allows.
+ */
+static bool w1_overrun(uint32_t start, uint32_t target)
+{
+	return (dwt_cycles() - start) > (target + w1_timing->slack);
 }
 
 /**
@@ -56,20 +112,28 @@ uint8_t w1_crc(uint8_t *buf, uint8_t len)
  */
 static void w1_write_bit(bool val)
 {
+	uint32_t start, low, release;
+
+	if (val) {
+		low = w1_timing->write1_low;
+		release = w1_timing->write1_release;
+	} else {
+		low = w1_timing->write0_low;
+		release = w1_timing->write0_release;
+	}
+
 	__disable_irq();
-	/* Pull low for 6µs for 1, 60µs for 0 */
+	start = dwt_cycles();
 	gpio_set_output(w1_gpio, false);
-	if (val)
-		dwt_delay(6);
-	else
-		dwt_delay(60);
-	/* Release to make up to 70µs total */
+	dwt_wait_until(start + low);
+	/* Release for the rest of the slot */
 	gpio_set_input(w1_gpio);
-	if (val)
-		dwt_delay(64);
-	else
-		dwt_delay(10);
+	if (w1_overrun(start, low))
+		w1_stats.write_overruns++;
 	__enable_irq();
+
+	/* Recovery only has a minimum length, so let interrupts run */
+	dwt_wait_until(start + low + release);
 }
 
 void w1_write(uint8_t val)
@@ -77,42 +141,35 @@ void w1_write(uint8_t val)
 	uint8_t i;
 
 	for (i = 0; i < 8; i++) {
-		__disable_irq();
-		/* Pull low for 6µs for 1, 60µs for 0 */
-		gpio_set_output(w1_gpio, false);
-		if (val & 1)
-			dwt_delay(6);
-		else
-			dwt_delay(60);
-		/* Release to make up to 70µs total */
-		gpio_set_input(w1_gpio);
-		if (val & 1)
-			dwt_delay(64);
-		else
-			dwt_delay(10);
-		__enable_irq();
-
+		w1_write_bit(val & 1);
 		val >>= 1;
 	}
 }
 
 bool w1_read_bit(void)
 {
+	uint32_t start, sample;
 	bool val;
 
+	sample = w1_timing->write1_low + w1_timing->read_sample;
+
 	__disable_irq();
-	/* Pull low for 6µs */
+	start = dwt_cycles();
+	/* Pull low to start the slot */
 	gpio_set_output(w1_gpio, false);
-	dwt_delay(6);
-	/* Release for 9µs */
+	dwt_wait_until(start + w1_timing->write1_low);
+	/* Release and let the slave drive the line */
 	gpio_set_input(w1_gpio);
-	dwt_delay(9);
+	dwt_wait_until(start + sample);
 
 	/* Read the line state */
 	val = gpio_get(w1_gpio);
+	if (w1_overrun(start, sample))
+		w1_stats.read_overruns++;
 	__enable_irq();
 
-	chopstx_usec_wait(55);
+	/* Recovery only has a minimum length, so let interrupts run */
+	dwt_wait_until(start + sample + w1_timing->read_release);
 
 	return val;
 }
@@ -149,21 +206,35 @@ void w1_read(uint8_t *buf, uint8_t len)
  */
 enum w1_present_state w1_reset(bool nowait)
 {
+	uint32_t start;
 	bool present;
 
-	/* Pull low for 480µs */
+	/*
+	 * Standard speed reset low time only has a minimum, so let interrupts
+	 * run. Overdrive has a maximum as well, so keep them off throughout.
+	 */
+	if (w1_speed == W1_SPEED_OVERDRIVE)
+		__disable_irq();
+	start = dwt_cycles();
 	gpio_set_output(w1_gpio, false);
-	chopstx_usec_wait(480);
-	/* Release for 70µs */
+	dwt_wait_until(start + w1_timing->reset_low);
+
+	/* Release, then sample presence at a precise point */
+	__disable_irq();
+	start = dwt_cycles();
 	gpio_set_input(w1_gpio);
-	chopstx_usec_wait(70);
+	dwt_wait_until(start + w1_timing->reset_presence);
 
 	/* If there's a device present it'll have pulled the line low */
 	present = !gpio_get(w1_gpio);
+	if (w1_overrun(start, w1_timing->reset_presence))
+		w1_stats.reset_overruns++;
+	__enable_irq();
 
-	/* Wait for reset to complete */
+	/* Wait for reset to complete; a slot boundary, so we can yield */
 	if (!nowait)
-		chopstx_usec_wait(410);
+		w1_wait_boundary(start + w1_timing->reset_presence +
+				w1_timing->reset_release);
 
 	if (!present)
 		return W1_NOT_PRESENT;
@@ -178,68 +249,95 @@ enum w1_present_state w1_reset(bool nowait)
 	return W1_PRESENT;
 }
 
-/**
- * 1-Wire binary search algorithm. See Maxim Application Note 187:
+static bool w1_bit(const uint8_t devid[8], int bit)
+{
+	return devid[bit >> 3] & (1 << (bit & 7));
+}
+
+/*
+ * Returns the first bit position at which two ROM IDs differ, which is the
+ * depth of the branch where their search paths split, or 64 if they match.
+ */
+static int w1_diverge(const uint8_t a[8], const uint8_t b[8])
+{
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		if (a[i] != b[i])
+			return i * 8 + __builtin_ctz(a[i] ^ b[i]);
+	}
+
+	return 64;
+}
+
+/*
+ * Performs a single pass of the 1-Wire search algorithm, with a single bus
+ * reset. See Maxim Application Note 187:
  *
  * https://www.maximintegrated.com/en/design/technical-documents/app-notes/1/187.html
  *
- * Called by w1_find_first and w1_find_next.
+ * Bits below fixed must follow the path in devid or the pass fails. Above
+ * that, bits below last follow devid, we take the 1 branch at last, and
+ * the 0 branch after it.
  *
- * :param state: Pointer to a state structure for the search. Will be
- *               be updated for subsequent calls to this function.
- * :param devid: 8 byte buffer containing the last seen device, and used for
- *               storing the ROM ID of the found device. Should be reused
- *               for repetative calls to this function.
- * :return: True if a device was found, false otherwise.
+ * :param cmd: Search command (W1_ROM_SEARCH / W1_ALARM_SEARCH)
+ * :param devid: Path to follow; updated with the ROM ID found
+ * :param fixed: Number of leading bits that must match devid
+ * :param last: Last discrepancy, 64 for the first pass
+ * :param other: If not NULL, set to a mask of the bit positions where
+ *               devices responded for the branch we didn't take
+ * :param depth: If not NULL, set to the number of bit positions examined
+ * :return: The new last discrepancy (64 if there are no more branches), or
+ *          -1 if no device was found on the path.
  */
-static bool w1_search(struct w1_search_state *state, uint8_t devid[8])
+static int w1_search_pass(uint8_t cmd, uint8_t devid[8], int fixed, int last,
+		uint64_t *other, int *depth)
 {
-	int i, last_zero;
 	bool cmp_id_bit, id_bit, search_direction;
+	int i, last_zero;
 
-	if (state->last_device_flag || !w1_reset(true)) {
-		state->last_device_flag = false;
-		state->last_discrepancy = 64;
+	if (other)
+		*other = 0;
+	if (depth)
+		*depth = 0;
 
-		return false;
-	}
+	if (w1_reset(false) != W1_PRESENT)
+		return -1;
+	w1_write(cmd);
 
 	last_zero = 64;
-
-	w1_reset(false);
-	w1_write(state->search_type);
-
 	for (i = 0; i < 64; i++) {
-		if (i == state->last_discrepancy)
-			search_direction = true;
-		else if (i > state->last_discrepancy)
-			search_direction = false;
-		else
-			search_direction =
-				(devid[i >> 3] & 1 << (i & 7));
-
 		id_bit = w1_read_bit();
 		cmp_id_bit = w1_read_bit();
 
-		/* No devices, clear state and return. */
-		if (id_bit && cmp_id_bit) {
-			state->last_device_flag = false;
-			state->last_discrepancy = 64;
+		/* No devices left on this path */
+		if (id_bit && cmp_id_bit)
+			return -1;
 
-			return false;
-		}
+		if (depth)
+			*depth = i + 1;
+
+		if (i < fixed || i < last)
+			search_direction = w1_bit(devid, i);
+		else
+			search_direction = (i == last);
 
 		if (!id_bit && !cmp_id_bit) {
 			/* Both bits valid, go the specified direction */
-			w1_write_bit(search_direction);
-		} else {
-			/* Only one bit valid, take that direction */
+			if (other)
+				*other |= 1ULL << i;
+			if (!search_direction && i >= fixed)
+				last_zero = i;
+		} else if (search_direction != id_bit) {
+			/* Only one bit valid, and it's the other branch */
+			if (other)
+				*other |= 1ULL << i;
+			if (i < fixed)
+				return -1;
 			search_direction = id_bit;
-			w1_write_bit(search_direction);
 		}
 
-		if (!id_bit && !cmp_id_bit && !search_direction)
-			last_zero = i;
+		w1_write_bit(search_direction);
 
 		if (search_direction)
 			devid[i >> 3] |= 1 << (i & 7);
@@ -247,12 +345,40 @@ static bool w1_search(struct w1_search_state *state, uint8_t devid[8])
 			devid[i >> 3] &= ~(1 << (i & 7));
 	}
 
+	return last_zero;
+}
+
+/**
+ * 1-Wire binary search algorithm; called by w1_find_first and w1_find_next.
+ *
+ * :param state: Pointer to a state structure for the search. Will be
+ *               be updated for subsequent calls to this function.
+ * :param devid: 8 byte buffer containing the last seen device, and used for
+ *               storing the ROM ID of the found device. Should be reused
+ *               for repetative calls to this function.
+ * :return: True if a device was found, false otherwise.
+ */
+static bool w1_search(struct w1_search_state *state, uint8_t devid[8])
+{
+	int last_zero;
+
+	if (!state->last_device_flag)
+		last_zero = w1_search_pass(state->search_type, devid, 0,
+				state->last_discrepancy, NULL, NULL);
+
+	if (state->last_device_flag || last_zero < 0) {
+		state->last_device_flag = false;
+		state->last_discrepancy = 64;
+
+		return false;
+	}
+
 	state->last_discrepancy = last_zero;
 	if (last_zero == 64) {
 		state->last_device_flag = true;
 	}
 
-	return (i == 64);
+	return true;
 }
 
 /**
@@ -290,9 +416,675 @@ bool w1_find_next(struct w1_search_state *state, uint8_t devid[8])
 	return w1_search(state, devid);
 }
 
+/*
+ * Avoid dynamic allocations. Rescans use the search type of the last scan,
+ * so default to a ROM search in case there hasn't been one.
+ */
+static struct w1_devlist static_devlist = {
+	.search_type = W1_ROM_SEARCH,
+};
+
+static bool w1_devlist_add(struct w1_devlist *list, const uint8_t devid[8])
+{
+	if (list->count == W1_MAX_DEVICES) {
+		list->overflow = true;
+		return false;
+	}
+
+	memcpy(list->dev[list->count].devid, devid, 8);
+	list->dev[list->count].flags = W1_DEV_NEW;
+	list->count++;
+
+	return true;
+}
+
+/**
+ * Does a full search of the bus and caches the devices found, ready for
+ * later incremental rescans with w1_rescan().
+ *
+ * :param cmd: Search command (W1_ROM_SEARCH / W1_ALARM_SEARCH)
+ * :return: The device list, with every device flagged W1_DEV_NEW
+ */
+struct w1_devlist *w1_scan(uint8_t cmd)
+{
+	struct w1_devlist *list = &static_devlist;
+	struct w1_search_state state;
+	uint8_t devid[8];
+	bool found;
+
+	list->search_type = cmd;
+	list->count = 0;
+	list->overflow = false;
+
+	found = w1_find_first(cmd, &state, devid);
+	while (found && w1_devlist_add(list, devid))
+		found = w1_find_next(&state, devid);
+
+	return list;
+}
+
+/*
+ * Finds any devices on the other side of a branch at the given bit
+ * position of the path in devid.
+ */
+static void w1_explore(struct w1_devlist *list, const uint8_t path[8],
+		int bit)
+{
+	uint8_t devid[8];
+	int i, last;
+
+	memcpy(devid, path, 8);
+	devid[bit >> 3] ^= 1 << (bit & 7);
+	for (i = bit + 1; i < 64; i++)
+		devid[i >> 3] &= ~(1 << (i & 7));
+
+	last = 64;
+	do {
+		last = w1_search_pass(list->search_type, devid, bit + 1, last,
+				NULL, NULL);
+		if (last < 0)
+			return;
+	} while (w1_devlist_add(list, devid) && last != 64);
+}
+
+/*
+ * Puts the cached devices back into search order (0 branches first), which
+ * new devices appended by a rescan will have disturbed.
+ */
+static void w1_devlist_sort(struct w1_devlist *list)
+{
+	struct w1_device tmp;
+	int d, i, j;
+
+	for (i = 1; i < list->count; i++) {
+		tmp = list->dev[i];
+		for (j = i; j > 0; j--) {
+			d = w1_diverge(list->dev[j - 1].devid, tmp.devid);
+			if (!w1_bit(list->dev[j - 1].devid, d))
+				break;
+			list->dev[j] = list->dev[j - 1];
+		}
+		list->dev[j] = tmp;
+	}
+}
+
+/*
+ * Returns the depth of the deepest branch on a device's path; beyond it no
+ * other known device shares its path. -1 if it's the only device.
+ */
+static int w1_leaf_branch(struct w1_devlist *list, int dev)
+{
+	int i, d, deepest;
+
+	deepest = -1;
+	for (i = 0; i < list->count; i++) {
+		if (i == dev)
+			continue;
+		d = w1_diverge(list->dev[i].devid, list->dev[dev].devid);
+		if (d > deepest)
+			deepest = d;
+	}
+
+	return deepest;
+}
+
+/**
+ * Rescans the bus for changes against the devices cached by the last call
+ * to w1_scan() or w1_rescan(), without walking the full search tree. Uses
+ * the same search type as the last w1_scan(), or a ROM search if there
+ * hasn't been one.
+ *
+ * A quick rescan only walks enough known device paths to pass through
+ * every branch of the cached tree, which checks the far side of each
+ * branch is still populated and spots new branches off any walked path,
+ * only searching beneath those. Which device is walked at each final
+ * branch alternates between calls, so while the bus is stable every path
+ * is walked at least every other rescan; a change beyond a final branch
+ * can take a couple of rescans to show up. A full rescan walks every
+ * device's path, confirming each complete ROM ID.
+ *
+ * Devices missing are flagged W1_DEV_GONE (and dropped on the next call),
+ * newly found devices are added to the end flagged W1_DEV_NEW.
+ *
+ * :param full: True to walk every known device's path
+ * :return: The updated device list
+ */
+struct w1_devlist *w1_rescan(bool full)
+{
+	struct w1_devlist *list = &static_devlist;
+	/* Per device: branch depth, walk result, other branches seen */
+	static int8_t branch[W1_MAX_DEVICES], depth[W1_MAX_DEVICES];
+	static uint64_t seen[W1_MAX_DEVICES];
+	uint8_t devid[8];
+	uint64_t expected, fresh;
+	int count, i, j, k, d;
+	bool present;
+
+	/* Drop devices that went last time and forget what was new */
+	count = 0;
+	for (i = 0; i < list->count; i++) {
+		if (list->dev[i].flags & W1_DEV_GONE)
+			continue;
+		list->dev[count].flags = 0;
+		memcpy(list->dev[count].devid, list->dev[i].devid, 8);
+		count++;
+	}
+	list->count = count;
+	list->overflow = false;
+	list->odd = !list->odd;
+	w1_devlist_sort(list);
+
+	if (count == 0)
+		return w1_scan(list->search_type);
+
+	/*
+	 * Pick the paths to walk: any device whose final branch isn't already
+	 * passed through by a chosen path. Alternate the order we consider
+	 * them in, so the other device at a final branch gets its turn.
+	 */
+	for (i = 0; i < count; i++) {
+		branch[i] = w1_leaf_branch(list, i);
+		depth[i] = -1;
+	}
+	for (k = 0; k < count; k++) {
+		i = list->odd ? count - 1 - k : k;
+		if (!full && branch[i] >= 0) {
+			for (j = 0; j < count; j++) {
+				if (depth[j] >= 0 && w1_diverge(list->dev[j].devid,
+						list->dev[i].devid) >= branch[i])
+					break;
+			}
+			if (j < count)
+				continue;
+		}
+
+		memcpy(devid, list->dev[i].devid, 8);
+		if (w1_search_pass(list->search_type, devid, 64, 64, &seen[i],
+				&d) < 0 && d == 64)
+			d = 63;
+		depth[i] = d;
+	}
+
+	/*
+	 * Work out who's still there. A walk that reached the end of the path
+	 * confirms the device; otherwise look for a walk that passed through
+	 * the device's final branch and saw whether anything was beyond it.
+	 * If nothing did, walk the device's path itself.
+	 */
+	for (i = 0; i < count; i++) {
+		if (depth[i] >= 0) {
+			present = (depth[i] == 64);
+		} else {
+			d = branch[i];
+			for (j = 0; j < count; j++) {
+				if (depth[j] > d && w1_diverge(list->dev[j].devid,
+						list->dev[i].devid) == d)
+					break;
+			}
+			if (j < count) {
+				present = seen[j] & (1ULL << d);
+			} else {
+				memcpy(devid, list->dev[i].devid, 8);
+				present = w1_search_pass(list->search_type,
+					devid, 64, 64, NULL, NULL) >= 0;
+			}
+		}
+
+		if (!present)
+			list->dev[i].flags = W1_DEV_GONE;
+	}
+
+	/*
+	 * Any branch seen on a walked path that none of the remaining devices
+	 * explain leads to new devices.
+	 */
+	for (i = 0; i < count; i++) {
+		if (depth[i] < 0)
+			continue;
+
+		expected = 0;
+		for (j = 0; j < count; j++) {
+			if (j == i || (list->dev[j].flags & W1_DEV_GONE))
+				continue;
+			d = w1_diverge(list->dev[j].devid, list->dev[i].devid);
+			expected |= 1ULL << d;
+		}
+
+		fresh = seen[i] & ~expected;
+		if (depth[i] < 64)
+			fresh &= (1ULL << depth[i]) - 1;
+
+		while (fresh) {
+			d = __builtin_ctzll(fresh);
+			fresh &= fresh - 1;
+
+			/* Another walked path may have found these already */
+			for (j = count; j < list->count; j++) {
+				if (w1_diverge(list->dev[j].devid,
+						list->dev[i].devid) == d)
+					break;
+			}
+			if (j == list->count)
+				w1_explore(list, list->dev[i].devid, d);
+		}
+	}
+
+	return list;
+}
+
+/*
+ * Bit-parallel engine for several 1-Wire buses on pins of the same GPIO
+ * port. The pins are left as open-drain outputs so a single port store can
+ * pull some lines low and release others, and every line is sampled with a
+ * single port read, so each slot takes the same time however many buses
+ * there are. Buses are identified by their index in the pin list passed to
+ * w1_multi_init(), and sets of buses are bitmaps of those indices.
+ */
+static struct w1_multi {
+	uint8_t gpio;
+	int count;
+	uint32_t mask[W1_MULTI_MAX];
+	uint32_t all;
+} w1_multi;
+
+/* Convert a bitmap of buses into the matching port pin mask */
+static uint32_t w1_multi_port(uint8_t buses)
+{
+	uint32_t mask = 0;
+	int i;
+
+	for (i = 0; i < w1_multi.count; i++) {
+		if (buses & (1 << i))
+			mask |= w1_multi.mask[i];
+	}
+
+	return mask;
+}
+
+/* Convert a port read into a bitmap of buses that were high */
+static uint8_t w1_multi_buses(uint32_t port)
+{
+	uint8_t buses = 0;
+	int i;
+
+	for (i = 0; i < w1_multi.count; i++) {
+		if (port & w1_multi.mask[i])
+			buses |= 1 << i;
+	}
+
+	return buses;
+}
+
+/**
+ * Sets up the pins for parallel 1-Wire operation. All pins must be on the
+ * same GPIO port.
+ *
+ * :param gpios: List of pins, one per bus
+ * :param count: Number of pins, up to W1_MULTI_MAX
+ * :return: True on success, false if the pins can't be driven together
+ */
+bool w1_multi_init(const uint8_t *gpios, int count)
+{
+	int i;
+
+	if (count < 1 || count > W1_MULTI_MAX)
+		return false;
+
+	for (i = 1; i < count; i++) {
+		if ((gpios[i] >> 4) != (gpios[0] >> 4))
+			return false;
+	}
+
+	w1_multi.gpio = gpios[0];
+	w1_multi.count = count;
+	w1_multi.all = 0;
+	for (i = 0; i < count; i++) {
+		w1_multi.mask[i] = GPIO_MASK(gpios[i]);
+		w1_multi.all |= w1_multi.mask[i];
+
+		/* Released; open-drain lets the pull up take the line high */
+		gpio_set(gpios[i], true);
+		gpio_set_output(gpios[i], true);
+	}
+
+	return true;
+}
+
+/**
+ * Resets a set of buses in parallel.
+ *
+ * :param buses: Bitmap of buses to reset
+ * :return: Bitmap of buses where a presence pulse was seen
+ */
+uint8_t w1_multi_reset(uint8_t buses)
+{
+	uint32_t mask, port, start;
+
+	mask = w1_multi_port(buses);
+
+	/* Overdrive reset low time has a maximum, as for w1_reset() */
+	if (w1_speed == W1_SPEED_OVERDRIVE)
+		__disable_irq();
+	start = dwt_cycles();
+	gpio_port_set(w1_multi.gpio, 0, mask);
+	dwt_wait_until(start + w1_timing->reset_low);
+
+	__disable_irq();
+	start = dwt_cycles();
+	gpio_port_set(w1_multi.gpio, mask, 0);
+	dwt_wait_until(start + w1_timing->reset_presence);
+
+	port = gpio_port_get(w1_multi.gpio);
+	if (w1_overrun(start, w1_timing->reset_presence))
+		w1_stats.reset_overruns++;
+	__enable_irq();
+
+	w1_wait_boundary(start + w1_timing->reset_presence +
+			w1_timing->reset_release);
+
+	/* Present devices pull the line low */
+	return buses & ~w1_multi_buses(port);
+}
+
+/*
+ * Writes a bit to each of a set of buses; a 1 to those in ones, a 0 to the
+ * rest.
+ */
+static void w1_multi_write_bits(uint8_t buses, uint8_t ones)
+{
+	uint32_t mask, one, start, slot;
+
+	mask = w1_multi_port(buses);
+	one = w1_multi_port(buses & ones);
+
+	/* Standard speed slots are the same length either way, overdrive not */
+	slot = w1_timing->write0_low + w1_timing->write0_release;
+	if (w1_timing->write1_low + w1_timing->write1_release > slot)
+		slot = w1_timing->write1_low + w1_timing->write1_release;
+
+	__disable_irq();
+	start = dwt_cycles();
+	gpio_port_set(w1_multi.gpio, 0, mask);
+	dwt_wait_until(start + w1_timing->write1_low);
+	gpio_port_set(w1_multi.gpio, one, 0);
+	if (w1_overrun(start, w1_timing->write1_low))
+		w1_stats.write_overruns++;
+	dwt_wait_until(start + w1_timing->write0_low);
+	gpio_port_set(w1_multi.gpio, mask, 0);
+	if (w1_overrun(start, w1_timing->write0_low))
+		w1_stats.write_overruns++;
+	__enable_irq();
+
+	dwt_wait_until(start + slot);
+}
+
+/**
+ * Writes the same byte to a set of buses in parallel.
+ *
+ * :param buses: Bitmap of buses to write to
+ * :param val: Byte to write
+ */
+void w1_multi_write(uint8_t buses, uint8_t val)
+{
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		w1_multi_write_bits(buses, (val & 1) ? 0xFF : 0);
+		val >>= 1;
+	}
+}
+
+/**
+ * Does a read slot on a set of buses in parallel.
+ *
+ * :param buses: Bitmap of buses to read from
+ * :return: Bitmap of the buses that read a 1
+ */
+uint8_t w1_multi_read_bit(uint8_t buses)
+{
+	uint32_t mask, port, start, sample;
+
+	mask = w1_multi_port(buses);
+	sample = w1_timing->write1_low + w1_timing->read_sample;
+
+	__disable_irq();
+	start = dwt_cycles();
+	gpio_port_set(w1_multi.gpio, 0, mask);
+	dwt_wait_until(start + w1_timing->write1_low);
+	gpio_port_set(w1_multi.gpio, mask, 0);
+	dwt_wait_until(start + sample);
+
+	port = gpio_port_get(w1_multi.gpio);
+	if (w1_overrun(start, sample))
+		w1_stats.read_overruns++;
+	__enable_irq();
+
+	dwt_wait_until(start + sample + w1_timing->read_release);
+
+	return buses & w1_multi_buses(port);
+}
+
+/**
+ * Reads a byte from each of a set of buses in parallel.
+ *
+ * :param buses: Bitmap of buses to read from
+ * :param vals: Filled in with the byte read from each bus, indexed by bus;
+ *              entries for buses not read are left alone
+ */
+void w1_multi_read(uint8_t buses, uint8_t *vals)
+{
+	uint8_t bits[8];
+	int i, j;
+
+	for (i = 0; i < 8; i++)
+		bits[i] = w1_multi_read_bit(buses);
+
+	for (j = 0; j < w1_multi.count; j++) {
+		if (!(buses & (1 << j)))
+			continue;
+		vals[j] = 0;
+		for (i = 0; i < 8; i++) {
+			if (bits[i] & (1 << j))
+				vals[j] |= 1 << i;
+		}
+	}
+}
+
+/*
+ * A single search pass on every bus that still has devices to find, in
+ * lock step. Follows the same rules as w1_search_pass(), per bus.
+ */
+static uint8_t w1_multi_search(struct w1_multi_search_state *state,
+		uint8_t devid[][8])
+{
+	uint8_t active, all, id_bits, cmp_bits, ones;
+	bool id_bit, cmp_id_bit, search_direction;
+	int last_zero[W1_MULTI_MAX];
+	int b, i, last;
+
+	all = (1 << w1_multi.count) - 1;
+	active = w1_multi_reset(all & ~state->done);
+	state->done |= all & ~active;
+	w1_multi_write(active, state->search_type);
+
+	for (b = 0; b < w1_multi.count; b++)
+		last_zero[b] = 64;
+
+	for (i = 0; i < 64 && active; i++) {
+		id_bits = w1_multi_read_bit(active);
+		cmp_bits = w1_multi_read_bit(active);
+
+		ones = 0;
+		for (b = 0; b < w1_multi.count; b++) {
+			if (!(active & (1 << b)))
+				continue;
+
+			id_bit = id_bits & (1 << b);
+			cmp_id_bit = cmp_bits & (1 << b);
+
+			/* No devices on this bus */
+			if (id_bit && cmp_id_bit) {
+				active &= ~(1 << b);
+				state->done |= 1 << b;
+				continue;
+			}
+
+			last = state->last_discrepancy[b];
+			if (id_bit || cmp_id_bit)
+				search_direction = id_bit;
+			else if (i < last)
+				search_direction = w1_bit(devid[b], i);
+			else
+				search_direction = (i == last);
+
+			if (!id_bit && !cmp_id_bit && !search_direction)
+				last_zero[b] = i;
+
+			if (search_direction) {
+				devid[b][i >> 3] |= 1 << (i & 7);
+				ones |= 1 << b;
+			} else {
+				devid[b][i >> 3] &= ~(1 << (i & 7));
+			}
+		}
+
+		w1_multi_write_bits(active, ones);
+	}
+
+	for (b = 0; b < w1_multi.count; b++) {
+		if (!(active & (1 << b)))
+			continue;
+		state->last_discrepancy[b] = last_zero[b];
+		if (last_zero[b] == 64)
+			state->done |= 1 << b;
+	}
+
+	return active;
+}
+
+/**
+ * Finds the first device on every bus in parallel. Buses can run out of
+ * devices at different points; keep calling w1_multi_find_next() until it
+ * returns 0.
+ *
+ * :param cmd: Search command (W1_ROM_SEARCH / W1_ALARM_SEARCH)
+ * :param state: Search state, initialised by this function
+ * :param devid: ROM ID found for each bus, indexed by bus
+ * :return: Bitmap of buses where a device was found
+ */
+uint8_t w1_multi_find_first(uint8_t cmd, struct w1_multi_search_state *state,
+		uint8_t devid[][8])
+{
+	int b;
+
+	state->search_type = cmd;
+	state->done = 0;
+	for (b = 0; b < W1_MULTI_MAX; b++) {
+		state->last_discrepancy[b] = 64;
+		memset(devid[b], 0, 8);
+	}
+
+	return w1_multi_search(state, devid);
+}
+
+/**
+ * Finds the next device on every bus that has more to find.
+ *
+ * :return: Bitmap of buses where a device was found
+ */
+uint8_t w1_multi_find_next(struct w1_multi_search_state *state,
+		uint8_t devid[][8])
+{
+	if (state->done == (1 << w1_multi.count) - 1)
+		return 0;
+
+	return w1_multi_search(state, devid);
+}
+
+/**
+ * Sets the speed used for subsequent resets and slots. Switching to
+ * overdrive only makes sense once the devices have been told to via
+ * W1_OD_SKIP_ROM or W1_OD_MATCH_ROM; a standard speed reset returns all
+ * devices to standard speed.
+ *
+ * :param speed: W1_SPEED_STANDARD or W1_SPEED_OVERDRIVE
+ */
+void w1_set_speed(enum w1_speed speed)
+{
+	w1_speed = speed;
+	w1_timing = &w1_timings[speed];
+}
+
+enum w1_speed w1_get_speed(void)
+{
+	return w1_speed;
+}
+
+/**
+ * Retrieves the counts of slots where a timing critical edge or sample
+ * happened later than the 1-Wire timing allows.
+ *
+ * :param stats: Structure to fill in with the current counters
+ * :param clear: True if the counters should be reset afterwards
+ */
+void w1_get_stats(struct w1_stats *stats, bool clear)
+{
+	*stats = w1_stats;
+	if (clear)
+		memset(&w1_stats, 0, sizeof(w1_stats));
+}
+
+/**
+ * Resets the bus at standard speed and puts all devices into overdrive using
+ * Overdrive Skip ROM. Subsequent operations run at overdrive speed.
+ *
+ * :return: An indication of whether there are 1-wire devices present
+ */
+enum w1_present_state w1_overdrive_skip(void)
+{
+	enum w1_present_state present;
+
+	w1_set_speed(W1_SPEED_STANDARD);
+	present = w1_reset(false);
+	if (present != W1_PRESENT)
+		return present;
+
+	w1_write(W1_OD_SKIP_ROM);
+	w1_set_speed(W1_SPEED_OVERDRIVE);
+
+	return present;
+}
+
+/**
+ * Resets the bus at standard speed and selects a single device using
+ * Overdrive Match ROM, leaving it in overdrive. The ROM ID is sent at
+ * overdrive speed, as are subsequent operations.
+ *
+ * :param devid: 8 byte ROM ID of the device to select
+ * :return: An indication of whether there are 1-wire devices present
+ */
+enum w1_present_state w1_overdrive_match(const uint8_t devid[8])
+{
+	enum w1_present_state present;
+	int i;
+
+	w1_set_speed(W1_SPEED_STANDARD);
+	present = w1_reset(false);
+	if (present != W1_PRESENT)
+		return present;
+
+	w1_write(W1_OD_MATCH_ROM);
+	w1_set_speed(W1_SPEED_OVERDRIVE);
+	for (i = 0; i < 8; i++)
+		w1_write(devid[i]);
+
+	return present;
+}
+
 void w1_init(uint8_t gpio)
 {
 	w1_gpio = gpio;
+	w1_set_speed(W1_SPEED_STANDARD);
 	/* Set 1w pin to low */
 	gpio_set(w1_gpio, false);
 	/* Set 1w pin to input to let it float high */
@@ -12,12 +12,65 @@
 /* In gpio.c, but we don't want it generally visible */
 void gpio_advance_clock(int us);
 
+/* Emulated cycle counter, and cycles not yet passed on to the GPIO clock */
+static uint32_t dwt_count, dwt_frac;
+
+/*
+ * Advance the emulated cycle counter, telling the GPIO module about each
+ * whole µs that passes.
+ */
+static void dwt_advance(uint32_t cycles)
+{
+	dwt_count += cycles;
+	dwt_frac += cycles;
+	if (dwt_frac >= MHZ) {
+		gpio_advance_clock(dwt_frac / MHZ);
+		dwt_frac %= MHZ;
+	}
+}
+
+/**
+ * Return the emulated cycle count. Reading the counter takes time on real
+ * hardware; advancing it a little here stops polling loops from spinning
+ * forever.
+ */
+uint32_t dwt_cycles(void)
+{
+	dwt_advance(1);
+
+	return dwt_count;
+}
+
 /**
  * Tell the GPIO module we waited for a certain number of µs
  */
 void dwt_delay(uint16_t us)
 {
-	gpio_advance_clock(us);
+	dwt_advance(us * MHZ);
+}
+
+/**
+ * Advance the emulated cycle counter rather than really sleeping, so long
+ * waits take no time and the VCD timeline includes them.
+ */
+void dwt_sleep(uint32_t us)
+{
+	/* A second at a time, so the cycle count doesn't overflow */
+	while (us > 1000000) {
+		dwt_advance(1000000 * MHZ);
+		us -= 1000000;
+	}
+	dwt_advance(us * MHZ);
+}
+
+/**
+ * Advance the emulated cycle counter up to the deadline, if it's not
+ * already passed.
+ */
+void dwt_wait_until(uint32_t deadline)
+{
+	if ((int32_t) (deadline - dwt_count) > 0)
+		dwt_advance(deadline - dwt_count);
 }
 
 /**
@@ -8,6 +8,8 @@
  */
 #include <stdint.h>
 
+#include <chopstx.h>
+
 #include "dwt.h"
 
 /* DWT register layout */
@@ -21,6 +23,12 @@ static struct DWT *const DWT = (struct DWT *)0xE0001000;
 static volatile uint32_t *DEMCR = (uint32_t *)0xE000EDFC;
 #define TRCENA (1UL << 24)
 
+/* Return the current DWT cycle count, which runs at MHZ cycles per µs */
+uint32_t dwt_cycles(void)
+{
+	return DWT->CYCCNT;
+}
+
 /* Busy wait for a certain number of µs using the DWT counter */
 void dwt_delay(uint16_t us)
 {
@@ -31,6 +39,25 @@ void dwt_delay(uint16_t us)
 		;
 }
 
+/*
+ * Wait for at least a certain number of µs, letting other threads run. For
+ * longer waits that don't need to be precise.
+ */
+void dwt_sleep(uint32_t us)
+{
+	chopstx_usec_wait(us);
+}
+
+/*
+ * Busy wait until the DWT counter reaches a deadline previously calculated
+ * from dwt_cycles(). Returns immediately if it's already passed.
+ */
+void dwt_wait_until(uint32_t deadline)
+{
+	while ((int32_t) (deadline - DWT->CYCCNT) > 0)
+		;
+}
+
 /* Initialise and reset the DWT counter */
 void dwt_init(void)
 {
@@ -0,0 +1,177 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ * Emulated 24C256 I2C EEPROM for Linux emulation mode
+ *
+ * Attached to the CLK (SCL) and MOSI (SDA) pins at address 0x50, so the
+ * I2C code can be exercised without real hardware. Models sequential reads,
+ * page writes with page roll over, and a busy period after each write
+ * during which the device won't ACK its address.
+ *
+ * Copyright 2021 Jonathan McDowell <noodles@earth.li>
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#define EMU_EEPROM_ADDR		0x50
+#define EMU_EEPROM_SIZE		32768
+#define EMU_EEPROM_PAGE		64
+/* Number of address polls the device ignores after a write */
+#define EMU_EEPROM_BUSY		3
+
+enum emu_eeprom_phase {
+	EMU_IDLE,
+	EMU_DEV_ADDR,
+	EMU_WORD_ADDR,
+	EMU_WRITE,
+	EMU_READ,
+};
+
+static struct emu_eeprom {
+	bool init;
+	/* Last SCL/SDA levels driven by the bus master */
+	bool scl, sda;
+	/* True when we're pulling SDA low */
+	bool pull;
+	/* True when we're sending data bytes to the master */
+	bool tx;
+
+	enum emu_eeprom_phase phase;
+	/* Number of SCL rising edges seen in the current byte + ack */
+	int clk;
+	uint8_t shift;
+	int addr_left;
+	bool written;
+	int busy;
+	uint16_t ptr;
+
+	uint8_t mem[EMU_EEPROM_SIZE];
+} emu;
+
+/* A complete byte has been clocked in from the master */
+static bool emu_eeprom_byte_in(uint8_t b)
+{
+	switch (emu.phase) {
+	case EMU_DEV_ADDR:
+		if ((b >> 1) != EMU_EEPROM_ADDR) {
+			emu.phase = EMU_IDLE;
+			return false;
+		}
+		if (emu.busy) {
+			/* Still in our write cycle */
+			emu.busy--;
+			emu.phase = EMU_IDLE;
+			return false;
+		}
+		if (b & 1) {
+			emu.phase = EMU_READ;
+		} else {
+			emu.phase = EMU_WORD_ADDR;
+			emu.addr_left = 2;
+		}
+		return true;
+	case EMU_WORD_ADDR:
+		emu.ptr = ((emu.ptr << 8) | b) & (EMU_EEPROM_SIZE - 1);
+		if (--emu.addr_left == 0)
+			emu.phase = EMU_WRITE;
+		return true;
+	case EMU_WRITE:
+		emu.mem[emu.ptr] = b;
+		/* Writes wrap within the current page */
+		emu.ptr = (emu.ptr & ~(EMU_EEPROM_PAGE - 1)) |
+			((emu.ptr + 1) & (EMU_EEPROM_PAGE - 1));
+		emu.written = true;
+		return true;
+	default:
+		return false;
+	}
+}
+
+static void emu_eeprom_scl_rise(void)
+{
+	emu.clk++;
+
+	if (emu.tx) {
+		/* 9th clock is the master's (n)ack */
+		if (emu.clk == 9 && emu.sda) {
+			emu.phase = EMU_IDLE;
+			emu.tx = false;
+		}
+	} else if (emu.clk <= 8) {
+		emu.shift = (emu.shift << 1) | emu.sda;
+	}
+}
+
+static void emu_eeprom_scl_fall(void)
+{
+	if (emu.phase == EMU_IDLE) {
+		emu.pull = false;
+		return;
+	}
+
+	if (emu.clk == 8) {
+		/* Ack clock is next */
+		if (emu.tx) {
+			emu.pull = false;
+			emu.ptr = (emu.ptr + 1) & (EMU_EEPROM_SIZE - 1);
+		} else {
+			emu.pull = emu_eeprom_byte_in(emu.shift);
+		}
+		return;
+	}
+
+	if (emu.clk == 9) {
+		emu.clk = 0;
+		/* Start transmitting once we've ACKed a read address */
+		emu.tx = (emu.phase == EMU_READ);
+	}
+
+	/* Drive the next data bit if we're transmitting */
+	if (emu.tx)
+		emu.pull = !((emu.mem[emu.ptr] << emu.clk) & 0x80);
+	else
+		emu.pull = false;
+}
+
+/**
+ * Called by the GPIO emulation whenever the levels the master is driving
+ * onto SCL/SDA may have changed.
+ */
+void emu_eeprom_update(bool scl, bool sda)
+{
+	if (!emu.init) {
+		memset(emu.mem, 0xFF, sizeof(emu.mem));
+		emu.scl = emu.sda = true;
+		emu.init = true;
+	}
+
+	if (scl != emu.scl) {
+		emu.scl = scl;
+		emu.sda = sda;
+		if (scl)
+			emu_eeprom_scl_rise();
+		else
+			emu_eeprom_scl_fall();
+	} else if (sda != emu.sda) {
+		emu.sda = sda;
+		if (!scl)
+			return;
+
+		/* SDA changing while SCL is high; start or stop */
+		if (emu.written)
+			emu.busy = EMU_EEPROM_BUSY;
+		emu.written = false;
+		emu.pull = false;
+		emu.tx = false;
+		emu.clk = 0;
+		emu.phase = sda ? EMU_IDLE : EMU_DEV_ADDR;
+	}
+}
+
+/**
+ * :return: True if the emulated EEPROM is pulling SDA low
+ */
+bool emu_eeprom_sda_low(void)
+{
+	return emu.pull;
+}
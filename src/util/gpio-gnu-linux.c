@@ -17,7 +17,13 @@
 #include "gpio.h"
 #include "version.h"
 
-#define USEC_IN_MSEC	1000L
+/* Pins whose level depends on the pull-up resistors */
+#define GPIO_PULLED_UP	(GPIO_MASK(PIN_CLK) | GPIO_MASK(PIN_CS) | \
+			 GPIO_MASK(PIN_MISO) | GPIO_MASK(PIN_MOSI))
+
+/* In eeprom-gnu-linux.c, but we don't want it generally visible */
+void emu_eeprom_update(bool scl, bool sda);
+bool emu_eeprom_sda_low(void);
 
 /**
  * The modes that a pin can be in
@@ -33,8 +39,10 @@ enum pin_mode {
  */
 static struct gpio_state {
 	FILE *vcdfile;
+	/* Emulated time in µs, advanced by the DWT code */
 	unsigned long ts;
-	time_t last_output;
+	/* Pins that may have changed since we last wrote to the VCD */
+	uint32_t dirty;
 
 	struct pin_state {
 		enum pin_mode mode;
@@ -63,6 +71,42 @@ static bool gpio_has_pullup(uint8_t gpio)
 	}
 }
 
+/**
+ * Returns the level we're driving the supplied GPIO pin to, ignoring any
+ * emulated devices. Takes into consideration the state of any pull-up
+ * resistors associated with the pin.
+ */
+static bool gpio_drive_level(uint8_t gpio)
+{
+	if (state.pins[gpio].mode == PIN_INPUT_FLOATING) {
+		return gpio_has_pullup(gpio);
+	} else if (state.pins[gpio].mode == PIN_OUTPUT_OPENDRAIN) {
+		return state.pins[gpio].state ? gpio_has_pullup(gpio) : false;
+	} else {
+		return state.pins[gpio].state;
+	}
+}
+
+/*
+ * Marks a pin as needing to be checked at the next VCD write, and lets the
+ * emulated I2C EEPROM on CLK/MOSI know if the bus may have changed.
+ */
+static void gpio_changed(uint8_t gpio)
+{
+	uint32_t mask = GPIO_MASK(gpio);
+
+	if (gpio == PIN_PULLUPS)
+		mask |= GPIO_PULLED_UP;
+	state.dirty |= mask;
+
+	if (mask & (GPIO_MASK(PIN_CLK) | GPIO_MASK(PIN_MOSI))) {
+		emu_eeprom_update(gpio_drive_level(PIN_CLK),
+				gpio_drive_level(PIN_MOSI));
+		/* The EEPROM may have started or stopped pulling SDA low */
+		state.dirty |= GPIO_MASK(PIN_MOSI);
+	}
+}
+
 /**
  * Returns the state of the GPIO as a char, suitable for the VCD file.
  * Z indicates Hi-Z (i.e input) and for an output either 0 or 1 will be
@@ -71,6 +115,10 @@ static bool gpio_has_pullup(uint8_t gpio)
  */
 static char gpio_state_to_char(uint8_t gpio)
 {
+	/* The emulated EEPROM can pull SDA low */
+	if (gpio == PIN_MOSI && emu_eeprom_sda_low())
+		return '0';
+
 	if (state.pins[gpio].mode == PIN_INPUT_FLOATING)
 		return gpio_has_pullup(gpio) ? '1' : 'Z';
 
@@ -86,67 +134,66 @@ static char gpio_state_to_char(uint8_t gpio)
 	return state.pins[gpio].state ? '1' : '0';
 }
 
-/**
- * Checks if our GPIO pin state has changed since we last wrote it to the VCD
- * and if so writes the timestamp and the most recent changes.
+/*
+ * Formats a VCD timestamp line prefix for the current time, without going
+ * through printf.
  *
- * :return: True if we wrote an update to the VCD.
+ * :return: The number of characters written to buf
  */
-static bool gpio_vcd_write_state(void)
+static int gpio_vcd_timestamp(char *buf)
 {
-	char *pin_tokens = "!\"#$%&'";
-	bool changed;
-	char s;
-	int i;
-
-	changed = false;
-	for (i = 0; !changed && i < PIN_COUNT; i++) {
-		if (state.last_state[i] != gpio_state_to_char(i)) {
-			changed = true;
-		}
-	}
-
-	if (!changed) {
-		return false;
-	}
-
-	/* Store the time we last output our state */
-	state.last_output = time(NULL);
-
-	fprintf(state.vcdfile, "#%ld", state.ts);
-
-	for (i = 0; i < PIN_COUNT; i++) {
-		s = gpio_state_to_char(i);
-		if (state.last_state[i] != s) {
-			state.last_state[i] = s;
-			fprintf(state.vcdfile, " %c%c", s, pin_tokens[i]);
-		}
-	}
-
-	fprintf(state.vcdfile, "\n");
-
-	return true;
+	char digits[20];
+	unsigned long ts = state.ts;
+	int i, len;
+
+	i = 0;
+	do {
+		digits[i++] = '0' + ts % 10;
+		ts /= 10;
+	} while (ts);
+
+	len = 0;
+	buf[len++] = '#';
+	while (i)
+		buf[len++] = digits[--i];
+
+	return len;
 }
 
 /**
- * Checks if it's been more than a second since we last output our state and
- * if so calls gpio_vcd_write_state() to write the current state if it's
- * changed.
+ * Writes the timestamp and new state of any pins that have changed since we
+ * last wrote to the VCD. Only pins marked dirty are looked at.
  */
-static void gpio_periodic_check(void)
+static void gpio_vcd_write_state(void)
 {
-	time_t t;
+	static const char pin_tokens[] = "!\"#$%&'";
+	char line[24 + PIN_COUNT * 3];
+	uint32_t dirty;
+	char s;
+	int i, len;
 
-	t = time(NULL);
+	dirty = state.dirty;
+	state.dirty = 0;
+	len = 0;
+	for (i = 0; dirty; i++, dirty >>= 1) {
+		if (!(dirty & 1))
+			continue;
 
-	if ((state.last_output + 1) >= t) {
-		return;
+		s = gpio_state_to_char(i);
+		if (state.last_state[i] == s)
+			continue;
+		state.last_state[i] = s;
+
+		if (len == 0)
+			len = gpio_vcd_timestamp(line);
+		line[len++] = ' ';
+		line[len++] = s;
+		line[len++] = pin_tokens[i];
 	}
 
-	if (gpio_vcd_write_state()) {
-		/* Bump the current clock up to the next millisecond */
-		state.ts += 2 * USEC_IN_MSEC;
-		state.ts -= (state.ts % USEC_IN_MSEC);
+	if (len) {
+		line[len++] = '\n';
+		fwrite(line, 1, len, state.vcdfile);
 	}
 }
 
@@ -157,12 +204,11 @@ static void gpio_periodic_check(void)
  */
 void gpio_set_input(uint8_t gpio)
 {
-	if (gpio >= PIN_COUNT)
+	if (gpio >= PIN_COUNT || state.pins[gpio].mode == PIN_INPUT_FLOATING)
 		return;
 
-	gpio_periodic_check();
-
 	state.pins[gpio].mode = PIN_INPUT_FLOATING;
+	gpio_changed(gpio);
 }
 
 /**
@@ -174,16 +220,17 @@ void gpio_set_input(uint8_t gpio)
  */
 void gpio_set_output(uint8_t gpio, bool open)
 {
+	enum pin_mode mode;
+
 	if (gpio >= PIN_COUNT)
 		return;
 
-	gpio_periodic_check();
+	mode = open ? PIN_OUTPUT_OPENDRAIN : PIN_OUTPUT_PUSHPULL;
+	if (state.pins[gpio].mode == mode)
+		return;
 
-	if (open) {
-		state.pins[gpio].mode = PIN_OUTPUT_OPENDRAIN;
-	} else {
-		state.pins[gpio].mode = PIN_OUTPUT_PUSHPULL;
-	}
+	state.pins[gpio].mode = mode;
+	gpio_changed(gpio);
 }
 
 /**
@@ -202,7 +249,8 @@ bool gpio_get_direction(uint8_t gpio)
 
 /**
  * Returns the current state (high/low) of the supplied GPIO pin. Takes into
- * consideration the state of any pull-up resistors associated with the pin.
+ * consideration the state of any pull-up resistors associated with the pin,
+ * and any emulated device pulling the line low.
  *
  * :return: true if the pin is high, false otherwise
  */
@@ -211,36 +259,77 @@ bool gpio_get(uint8_t gpio)
 	if (gpio >= PIN_COUNT)
 		return false;
 
-	if (state.pins[gpio].mode == PIN_INPUT_FLOATING) {
-		return gpio_has_pullup(gpio);
-	} else if (state.pins[gpio].mode == PIN_OUTPUT_OPENDRAIN) {
-		return state.pins[gpio].state ? gpio_has_pullup(gpio) : false;
-	} else {
-		return state.pins[gpio].state;
+	if (gpio == PIN_MOSI && emu_eeprom_sda_low())
+		return false;
+
+	return gpio_drive_level(gpio);
+}
+
+/**
+ * Reads the state of all of the emulated pins in one go. Use GPIO_MASK() to
+ * pick out individual pins.
+ *
+ * :param gpio: Ignored; all emulated pins are on a single port
+ * :return: Bitmask of the current pin states
+ */
+uint32_t gpio_port_get(uint8_t gpio)
+{
+	uint32_t val;
+	int i;
+
+	(void)gpio;
+
+	val = 0;
+	for (i = 0; i < PIN_COUNT; i++)
+		if (gpio_get(i))
+			val |= GPIO_MASK(i);
+
+	return val;
+}
+
+/**
+ * Sets and clears the outputs of several emulated pins in one go. Use
+ * GPIO_MASK() to build the masks.
+ *
+ * :param gpio: Ignored; all emulated pins are on a single port
+ * :param set: Mask of pins to set high
+ * :param clear: Mask of pins to set low; set takes priority
+ */
+void gpio_port_set(uint8_t gpio, uint32_t set, uint32_t clear)
+{
+	int i;
+
+	(void)gpio;
+
+	for (i = 0; i < PIN_COUNT; i++) {
+		if (set & GPIO_MASK(i))
+			gpio_set(i, true);
+		else if (clear & GPIO_MASK(i))
+			gpio_set(i, false);
 	}
 }
 
 void gpio_set(uint8_t gpio, bool on)
 {
-	if (gpio >= PIN_COUNT)
+	if (gpio >= PIN_COUNT || state.pins[gpio].state == on)
 		return;
 
-	gpio_periodic_check();
-
 	state.pins[gpio].state = on;
+	gpio_changed(gpio);
 }
 
 /**
- * Writes the current GPIO state (if it's changed since last time) and advances
- * the clock for the purposes of our VCD output.
+ * Writes any GPIO state changes and advances the clock for the purposes of
+ * our VCD output.
  *
- * Called by the dwt_delay() function
+ * Called by the DWT code as the emulated cycle counter passes each µs
  *
- * :param us: The time in µs to advance the clokc ticks by.
+ * :param us: The time in µs to advance the clock ticks by.
  */
 void gpio_advance_clock(int us)
 {
-	gpio_vcd_write_state();
+	if (state.dirty)
+		gpio_vcd_write_state();
 	state.ts += us;
 }
 
@@ -269,6 +358,8 @@ void bv_gpio_init(void)
 		return;
 
 	memset(&state, 0, sizeof(state));
+	/* Write every pin's initial state */
+	state.dirty = GPIO_MASK(PIN_COUNT) - 1;
 
 	state.pins[PIN_PULLUPS].state = false;
 	state.pins[PIN_PULLUPS].mode = PIN_OUTPUT_PUSHPULL;
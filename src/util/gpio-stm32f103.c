@@ -138,6 +138,41 @@ bool gpio_get(uint8_t gpio)
 	return !!(bank->IDR & (1 << (gpio & 15)));
 }
 
+/**
+ * Reads the state of every pin on the same port as the supplied GPIO in one
+ * go. Use GPIO_MASK() to pick out individual pins.
+ *
+ * :param gpio: Any GPIO pin on the port of interest
+ * :return: The input data register of the port
+ */
+uint32_t gpio_port_get(uint8_t gpio)
+{
+	struct GPIO *bank = gpio_get_base(gpio);
+
+	if (!bank)
+		return 0;
+
+	return bank->IDR;
+}
+
+/**
+ * Sets and clears the outputs of several pins on the same port as the
+ * supplied GPIO with a single store. Use GPIO_MASK() to build the masks.
+ *
+ * :param gpio: Any GPIO pin on the port of interest
+ * :param set: Mask of pins to set high
+ * :param clear: Mask of pins to set low; set takes priority
+ */
+void gpio_port_set(uint8_t gpio, uint32_t set, uint32_t clear)
+{
+	struct GPIO *bank = gpio_get_base(gpio);
+
+	if (!bank)
+		return;
+
+	bank->BSRR = (set & 0xFFFF) | ((clear & 0xFFFF) << 16);
+}
+
 void gpio_set(uint8_t gpio, bool on)
 {
 	struct GPIO *bank = gpio_get_base(gpio);
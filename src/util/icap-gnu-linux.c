@@ -0,0 +1,87 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ * Input capture for Linux emulation mode
+ *
+ * There's no real signal to measure, so a synthetic one is attached to the
+ * AUX pin: a 1kHz square wave with a 25% duty cycle, where every 8th high
+ * pulse is stretched to 50% so pulse width histograms have more than one
+ * bin in use. Edges are generated against the emulated DWT clock.
+ *
+ * Copyright 2021 Jonathan McDowell <noodles@earth.li>
+ */
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "dwt.h"
+#include "gpio.h"
+#include "icap.h"
+
+#define EMU_ICAP_PERIOD		(MHZ * 1000)
+#define EMU_ICAP_HIGH		(EMU_ICAP_PERIOD / 4)
+#define EMU_ICAP_LONG_HIGH	(EMU_ICAP_PERIOD / 2)
+#define EMU_ICAP_LONG_EVERY	8
+
+/* Avoid dynamic allocations */
+static struct icap_state {
+	/* Time of the next synthetic edge, and whether it's rising */
+	uint32_t next;
+	bool rising;
+	uint32_t pulse;
+} icap_state;
+
+/**
+ * Switches AUX to an input and starts generating edges on it.
+ */
+void icap_start(void)
+{
+	struct icap_state *ic = &icap_state;
+
+	gpio_set_input(PIN_AUX);
+
+	/* Start part way through a low period */
+	ic->next = dwt_cycles() + EMU_ICAP_PERIOD / 2;
+	ic->rising = true;
+	ic->pulse = 0;
+}
+
+/**
+ * Returns the next synthetic edge, if it's due.
+ *
+ * :param edge: Filled in with the edge details
+ * :return: True if there was an edge, false otherwise
+ */
+bool icap_next(struct icap_edge *edge)
+{
+	struct icap_state *ic = &icap_state;
+	uint32_t high;
+
+	if ((int32_t) (dwt_cycles() - ic->next) < 0)
+		return false;
+
+	edge->t = ic->next;
+	edge->rising = ic->rising;
+
+	high = (ic->pulse % EMU_ICAP_LONG_EVERY) ? EMU_ICAP_HIGH :
+		EMU_ICAP_LONG_HIGH;
+	if (ic->rising) {
+		ic->next += high;
+	} else {
+		ic->next += EMU_ICAP_PERIOD - high;
+		ic->pulse++;
+	}
+	ic->rising = !ic->rising;
+
+	return true;
+}
+
+/**
+ * :return: Always 0; we never lose synthetic edges
+ */
+uint32_t icap_missed(void)
+{
+	return 0;
+}
+
+void icap_stop(void)
+{
+}
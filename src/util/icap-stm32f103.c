@@ -0,0 +1,163 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ * Input capture of edges on the AUX pin
+ *
+ * AUX is PB8, which is TIM4 channel 3. The F1 timers can only capture one
+ * edge polarity per channel, so IC3 captures rising edges from TI3 and IC4
+ * is mapped onto TI3 as well to capture the falling ones. The timer runs
+ * undivided from the 72MHz APB1 timer clock (APB1 itself is /2), the same as
+ * the CPU, so 16 bit capture values can be extended to DWT timestamps by
+ * comparing against the live counter.
+ *
+ * Copyright 2021 Jonathan McDowell <noodles@earth.li>
+ */
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "dwt.h"
+#include "gpio.h"
+#include "icap.h"
+
+/* General purpose timer register layout */
+struct TIM {
+	volatile uint32_t CR1;
+	volatile uint32_t CR2;
+	volatile uint32_t SMCR;
+	volatile uint32_t DIER;
+	volatile uint32_t SR;
+	volatile uint32_t EGR;
+	volatile uint32_t CCMR1;
+	volatile uint32_t CCMR2;
+	volatile uint32_t CCER;
+	volatile uint32_t CNT;
+	volatile uint32_t PSC;
+	volatile uint32_t ARR;
+	volatile uint32_t RCR;
+	volatile uint32_t CCR1;
+	volatile uint32_t CCR2;
+	volatile uint32_t CCR3;
+	volatile uint32_t CCR4;
+};
+static struct TIM *const TIM4 = (struct TIM *)0x40000800;
+
+static volatile uint32_t *const ICAP_APB1ENR = (uint32_t *)0x4002101C;
+#define APB1ENR_TIM4EN	(1UL << 2)
+
+#define TIM_CR1_CEN	(1UL << 0)
+#define TIM_EGR_UG	(1UL << 0)
+#define TIM_SR_CC3IF	(1UL << 3)
+#define TIM_SR_CC4IF	(1UL << 4)
+#define TIM_SR_CC3OF	(1UL << 11)
+#define TIM_SR_CC4OF	(1UL << 12)
+/* IC3 on TI3, IC4 on TI3 */
+#define TIM_CCMR2_IC	((1UL << 0) | (2UL << 8))
+/* IC3 enabled on rising edges, IC4 enabled on falling edges */
+#define TIM_CCER_IC	((1UL << 8) | (1UL << 12) | (1UL << 13))
+
+/* Avoid dynamic allocations */
+static struct icap_state {
+	/* A newer edge read alongside the one we returned */
+	struct icap_edge pending;
+	bool have_pending;
+	uint32_t missed;
+} icap_state;
+
+/**
+ * Switches AUX to an input and starts capturing edges on it.
+ */
+void icap_start(void)
+{
+	struct icap_state *ic = &icap_state;
+
+	gpio_set_input(PIN_AUX);
+
+	*ICAP_APB1ENR |= APB1ENR_TIM4EN;
+	TIM4->CR1 = 0;
+	TIM4->PSC = 0;
+	TIM4->ARR = 0xFFFF;
+	TIM4->CCER = 0;
+	TIM4->CCMR2 = TIM_CCMR2_IC;
+	TIM4->CCER = TIM_CCER_IC;
+	TIM4->EGR = TIM_EGR_UG;
+	TIM4->SR = 0;
+	TIM4->CR1 = TIM_CR1_CEN;
+
+	ic->have_pending = false;
+	ic->missed = 0;
+}
+
+/**
+ * Returns the oldest captured edge not yet returned. Must be called often
+ * enough that no more than ~900µs passes between an edge and us seeing it,
+ * and before the next edge of the same polarity, or edges are lost.
+ *
+ * :param edge: Filled in with the edge details
+ * :return: True if there was an edge, false otherwise
+ */
+bool icap_next(struct icap_edge *edge)
+{
+	struct icap_state *ic = &icap_state;
+	uint32_t sr, now, cnt, rise, fall, rise_age, fall_age;
+
+	if (ic->have_pending) {
+		*edge = ic->pending;
+		ic->have_pending = false;
+		return true;
+	}
+
+	sr = TIM4->SR;
+	if (!(sr & (TIM_SR_CC3IF | TIM_SR_CC4IF)))
+		return false;
+
+	now = dwt_cycles();
+	cnt = TIM4->CNT;
+	if (sr & (TIM_SR_CC3OF | TIM_SR_CC4OF)) {
+		/* Overcapture flags are cleared by writing 0 */
+		TIM4->SR = ~(sr & (TIM_SR_CC3OF | TIM_SR_CC4OF));
+		ic->missed++;
+	}
+
+	if (!(sr & TIM_SR_CC4IF)) {
+		edge->t = now - ((cnt - TIM4->CCR3) & 0xFFFF);
+		edge->rising = true;
+		return true;
+	}
+	if (!(sr & TIM_SR_CC3IF)) {
+		edge->t = now - ((cnt - TIM4->CCR4) & 0xFFFF);
+		edge->rising = false;
+		return true;
+	}
+
+	/* Both polarities captured; return the older and keep the other */
+	rise = TIM4->CCR3;
+	fall = TIM4->CCR4;
+	rise_age = (cnt - rise) & 0xFFFF;
+	fall_age = (cnt - fall) & 0xFFFF;
+
+	edge->rising = rise_age > fall_age;
+	ic->pending.rising = !edge->rising;
+	edge->t = now - (edge->rising ? rise_age : fall_age);
+	ic->pending.t = now - (edge->rising ? fall_age : rise_age);
+	ic->have_pending = true;
+
+	return true;
+}
+
+/**
+ * :return: The number of times an edge was lost because we didn't read it
+ *          before the next one of the same polarity
+ */
+uint32_t icap_missed(void)
+{
+	return icap_state.missed;
+}
+
+/**
+ * Stops capturing edges; AUX is left as an input.
+ */
+void icap_stop(void)
+{
+	TIM4->CR1 = 0;
+	TIM4->CCER = 0;
+	*ICAP_APB1ENR &= ~APB1ENR_TIM4EN;
+}
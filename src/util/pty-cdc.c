@@ -0,0 +1,325 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ * Pseudo-terminal CDC backend for Linux emulation mode
+ *
+ * Presents each of the CDC ACM TTYs as a pty rather than a USB device
+ * exported over USBIP, so the emulation can be driven by an ordinary user
+ * with any serial tool. The slave side of each is symlinked as
+ * desk-viking-cdcN in the current directory.
+ *
+ * A TTY is connected while something has the slave side open. Reads return
+ * at most CDC_BUFSIZE bytes at a time, like a USB packet.
+ *
+ * Copyright 2021 Jonathan McDowell <noodles@earth.li>
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cdc.h"
+
+#define MAX_CDC 2
+/* How often to check for a client while waiting for one */
+#define CDC_PTY_WAIT_MS	10
+
+struct cdc {
+	int fd;
+	bool connected;
+	char link[32];
+};
+
+/* Avoid dynamic allocations */
+static struct cdc cdc_table[MAX_CDC];
+
+/* Set by SIGINT / SIGTERM; we exit next time we'd wait on a pty */
+static volatile sig_atomic_t cdc_pty_quit;
+
+/*
+ * Checks whether the slave side is open, discarding anything left over from
+ * the previous client if it's gone away.
+ */
+static bool cdc_pty_check(struct cdc *s)
+{
+	struct pollfd pfd;
+
+	pfd.fd = s->fd;
+	pfd.events = 0;
+	pfd.revents = 0;
+	if (poll(&pfd, 1, 0) < 0)
+		return s->connected;
+
+	if (pfd.revents & POLLHUP) {
+		if (s->connected)
+			tcflush(s->fd, TCIOFLUSH);
+		s->connected = false;
+	} else {
+		s->connected = true;
+	}
+
+	return s->connected;
+}
+
+static uint32_t cdc_pty_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void cdc_pty_exit(void)
+{
+	int i;
+
+	for (i = 0; i < MAX_CDC; i++)
+		unlink(cdc_table[i].link);
+}
+
+static void cdc_pty_signal(int sig)
+{
+	(void)sig;
+
+	cdc_pty_quit = 1;
+}
+
+/*
+ * Exits if we've been interrupted. exit() isn't safe from a signal handler,
+ * but we need it to get the VCD file written out.
+ */
+static void cdc_pty_check_quit(void)
+{
+	if (cdc_pty_quit)
+		exit(0);
+}
+
+void cdc_init(uint16_t prio, uintptr_t stack_addr, size_t stack_size,
+	void (*sendbrk_callback) (uint8_t dev_no, uint16_t duration),
+	void (*config_callback) (uint8_t dev_no,
+				uint32_t bitrate, uint8_t format,
+				uint8_t paritytype, uint8_t databits))
+{
+	struct sigaction sa;
+	struct termios tio;
+	const char *name;
+	int i, fd;
+
+	/* No USB thread to start, and no line settings to pass on */
+	(void)prio;
+	(void)stack_addr;
+	(void)stack_size;
+	(void)sendbrk_callback;
+	(void)config_callback;
+
+	for (i = 0; i < MAX_CDC; i++) {
+		struct cdc *s = &cdc_table[i];
+
+		s->fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+		if (s->fd < 0 || grantpt(s->fd) < 0 || unlockpt(s->fd) < 0) {
+			perror("Couldn't create pty");
+			exit(1);
+		}
+		name = ptsname(s->fd);
+
+		/* Binary data, so no echo or line editing */
+		tcgetattr(s->fd, &tio);
+		cfmakeraw(&tio);
+		tcsetattr(s->fd, TCSANOW, &tio);
+
+		/*
+		 * A pty that's never been opened doesn't report a hang up;
+		 * open and close the slave so it does until a client appears.
+		 */
+		fd = open(name, O_RDWR | O_NOCTTY);
+		if (fd >= 0)
+			close(fd);
+		s->connected = false;
+
+		snprintf(s->link, sizeof(s->link), "desk-viking-cdc%d", i);
+		unlink(s->link);
+		if (symlink(name, s->link) < 0)
+			s->link[0] = 0;
+
+		printf("CDC %d: %s%s%s\n", i, name, s->link[0] ? " as " : "",
+				s->link);
+	}
+
+	/* Scripts will be waiting on this to find the ptys */
+	fflush(stdout);
+
+	atexit(cdc_pty_exit);
+	/* No SA_RESTART, so a signal interrupts whatever we're waiting in */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = cdc_pty_signal;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+}
+
+void cdc_wait_configured(void)
+{
+	/* Nothing to configure */
+}
+
+struct cdc *cdc_open(uint8_t num)
+{
+	if (num >= MAX_CDC)
+		return NULL;
+
+	return &cdc_table[num];
+}
+
+bool cdc_connected(struct cdc *s, bool wait)
+{
+	while (!cdc_pty_check(s) && wait) {
+		cdc_pty_check_quit();
+		poll(NULL, 0, CDC_PTY_WAIT_MS);
+	}
+
+	return s->connected;
+}
+
+/*
+ * Returns -1 on connection close
+ *          0 on timeout.
+ *          >0 length of the input
+ */
+int cdc_recv(struct cdc *s, uint8_t *buf, uint32_t *timeout)
+{
+	struct pollfd pfd;
+	uint32_t start, waited;
+	int r, ms;
+
+	start = cdc_pty_now_us();
+	while (1) {
+		cdc_pty_check_quit();
+		if (!cdc_pty_check(s))
+			return -1;
+
+		r = read(s->fd, buf, CDC_BUFSIZE);
+		if (r > 0)
+			break;
+		if (r < 0 && errno != EAGAIN && errno != EINTR)
+			return -1;
+
+		if (timeout != NULL) {
+			waited = cdc_pty_now_us() - start;
+			if (waited >= *timeout) {
+				*timeout = 0;
+				return 0;
+			}
+			ms = (*timeout - waited + 999) / 1000;
+		} else {
+			ms = -1;
+		}
+
+		/* A hang up also wakes us, so we notice disconnection */
+		pfd.fd = s->fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		if (poll(&pfd, 1, ms) < 0 && errno != EINTR)
+			return -1;
+	}
+
+	if (timeout != NULL) {
+		waited = cdc_pty_now_us() - start;
+		*timeout = (waited < *timeout) ? *timeout - waited : 0;
+	}
+
+	return r;
+}
+
+/*
+ * Writes as much as the pty will take without blocking.
+ *
+ * Returns -1 on connection close, otherwise the number of bytes written
+ */
+static int cdc_pty_write(struct cdc *s, const uint8_t *buf, int len)
+{
+	int r;
+
+	if (!cdc_pty_check(s))
+		return -1;
+
+	r = write(s->fd, buf, len);
+	if (r < 0)
+		return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+
+	return r;
+}
+
+int cdc_send(struct cdc *s, const uint8_t *buf, int len)
+{
+	struct pollfd pfd;
+	int r;
+
+	while (len > 0) {
+		cdc_pty_check_quit();
+		r = cdc_pty_write(s, buf, len);
+		if (r < 0)
+			return -1;
+		buf += r;
+		len -= r;
+		if (len == 0)
+			break;
+
+		/* Wait for the client to read some */
+		pfd.fd = s->fd;
+		pfd.events = POLLOUT;
+		pfd.revents = 0;
+		poll(&pfd, 1, CDC_PTY_WAIT_MS);
+	}
+
+	return 1;
+}
+
+/*
+ * There are no packets or ZLPs on a pty, so a transfer with more to follow
+ * is the same as any other.
+ */
+int cdc_send_more(struct cdc *s, const uint8_t *buf, int len)
+{
+	return cdc_send(s, buf, len);
+}
+
+/*
+ * Writes up to CDC_BUFSIZE bytes if the pty has room, without waiting unless
+ * it only partly fits.
+ *
+ * Returns -1 on connection close
+ *          0 if there's no room
+ *         >0 length written
+ */
+int cdc_send_nowait(struct cdc *s, const uint8_t *buf, int len)
+{
+	int r;
+
+	if (len > CDC_BUFSIZE)
+		len = CDC_BUFSIZE;
+
+	r = cdc_pty_write(s, buf, len);
+	/* Callers expect all or nothing, so finish off a partial write */
+	if (r > 0 && r < len && cdc_send(s, buf + r, len - r) < 0)
+		return -1;
+
+	return r > 0 ? len : r;
+}
+
+int cdc_ss_notify(struct cdc *s, uint16_t state_bits)
+{
+	/* No serial state lines on a pty */
+	(void)s;
+	(void)state_bits;
+
+	return 0;
+}
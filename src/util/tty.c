@@ -62,6 +62,20 @@ void tty_printdec(struct cdc *tty, int val)
 	tty_printf(tty, buf);
 }
 
+void tty_printudec(struct cdc *tty, uint32_t val)
+{
+	char buf[11];
+	int pos = sizeof(buf) - 1;
+
+	buf[pos] = 0;
+	do {
+		buf[--pos] = (val % 10) + '0';
+		val /= 10;
+	} while (val > 0);
+
+	tty_printf(tty, &buf[pos]);
+}
+
 void tty_printhex(struct cdc *tty, unsigned int val, int places)
 {
 	char buf[7];
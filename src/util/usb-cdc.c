@@ -870,7 +870,21 @@ int cdc_recv(struct cdc *s, uint8_t *buf, uint32_t *timeout)
 	return r;
 }
 
-int cdc_send(struct cdc *s, const uint8_t *buf, int len)
+/* Queues a packet on the bulk endpoint; called with the mutex held */
+static void cdc_tx_start(struct cdc *s, const uint8_t *p, int count)
+{
+#ifdef GNU_LINUX_EMULATION
+	memcpy(s->send_buf0, p, count);
+	usb_lld_tx_enable_buf(s->bulk_ep, s->send_buf0, count);
+#else
+	usb_lld_txcpy(p, s->bulk_ep, 0, count);
+	usb_lld_tx_enable(s->bulk_ep, count);
+#endif
+	s->flag_output_ready = 0;
+}
+
+static int cdc_send_int(struct cdc *s, const uint8_t *buf, int len,
+		bool more)
 {
 	int r;
 	const uint8_t *p;
@@ -883,24 +897,17 @@ int cdc_send(struct cdc *s, const uint8_t *buf, int len)
 		chopstx_mutex_lock(&s->mtx);
 		while ((r = check_tx(s)) == 0)
 			chopstx_cond_wait(&s->cnd_tx, &s->mtx);
-		if (r > 0) {
-#ifdef GNU_LINUX_EMULATION
-			memcpy(s->send_buf0, p, count);
-			usb_lld_tx_enable_buf(s->bulk_ep, s->send_buf0, count);
-#else
-			usb_lld_txcpy(p, s->bulk_ep, 0, count);
-			usb_lld_tx_enable(s->bulk_ep, count);
-#endif
-			s->flag_output_ready = 0;
-		}
+		if (r > 0)
+			cdc_tx_start(s, p, count);
 		chopstx_mutex_unlock(&s->mtx);
 
 		len -= count;
 		p += count;
-		if (len == 0 && count != CDC_BUFSIZE)
+		if (len == 0 && (count != CDC_BUFSIZE || more))
 		/*
 		 * The size of the last packet should be != 0
-		 * If 64 (CDC_BUFSIZE), send ZLP (zelo length packet)
+		 * If 64 (CDC_BUFSIZE), send ZLP (zelo length packet), unless
+		 * the caller has told us more data follows.
 		 */
 			break;
 		count = len >= CDC_BUFSIZE ? CDC_BUFSIZE : len;
@@ -909,6 +916,50 @@ int cdc_send(struct cdc *s, const uint8_t *buf, int len)
 	return r;
 }
 
+int cdc_send(struct cdc *s, const uint8_t *buf, int len)
+{
+	return cdc_send_int(s, buf, len, false);
+}
+
+/*
+ * As cdc_send(), but for data that is part of a larger transfer. A final
+ * full sized packet isn't followed by a ZLP, so we return as soon as it's
+ * queued rather than waiting for it to go out, and the caller can get on
+ * with producing the next packet. The transfer must be finished with a
+ * cdc_send().
+ */
+int cdc_send_more(struct cdc *s, const uint8_t *buf, int len)
+{
+	return cdc_send_int(s, buf, len, true);
+}
+
+/*
+ * Queues a single packet of up to CDC_BUFSIZE bytes if the endpoint is free,
+ * without ever waiting. As with cdc_send_more() there's no ZLP, so the
+ * transfer must be finished with a cdc_send().
+ *
+ * Returns -1 on connection close
+ *          0 if the previous packet hasn't gone yet
+ *         >0 length queued
+ */
+int cdc_send_nowait(struct cdc *s, const uint8_t *buf, int len)
+{
+	int r;
+
+	if (len > CDC_BUFSIZE)
+		len = CDC_BUFSIZE;
+
+	chopstx_mutex_lock(&s->mtx);
+	r = check_tx(s);
+	if (r > 0) {
+		cdc_tx_start(s, buf, len);
+		r = len;
+	}
+	chopstx_mutex_unlock(&s->mtx);
+
+	return r;
+}
+
 int cdc_ss_notify(struct cdc *s, uint16_t state_bits)
 {
 	int busy;
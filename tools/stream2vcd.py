@@ -0,0 +1,140 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: GPL-3.0-or-later
+#
+# Converts a Desk Viking streaming transition capture (Bus Pirate binary mode
+# command 0x0E) to a VCD file, which sigrok/PulseView can import. Either
+# converts a raw capture already saved to a file, or captures directly from
+# the device with --port (needs pyserial) until interrupted with Ctrl-C.
+#
+# Copyright 2021 Jonathan McDowell <noodles@earth.li>
+
+import argparse
+import sys
+import time
+
+# Record types, as per include/la.h
+REC_CLOCK = 0x80
+REC_OVERFLOW = 0x81
+REC_END = 0x82
+
+# Pin state bits and VCD identifiers, matching the emulation VCD output
+PINS = [
+    (0x01, '!', 'AUX'),
+    (0x02, '"', 'MOSI'),
+    (0x04, '#', 'CLK'),
+    (0x08, '$', 'MISO'),
+    (0x10, '%', 'CS'),
+]
+
+
+def capture(port):
+    import serial
+
+    ser = serial.Serial(port, timeout=0.1)
+    # Into Bus Pirate binary mode, then start streaming
+    ser.write(b'\r')
+    time.sleep(0.1)
+    ser.reset_input_buffer()
+    ser.write(b'\0' * 20)
+    if b'BBIO1' not in ser.read(64):
+        sys.exit('No response to Bus Pirate binary mode entry')
+    ser.reset_input_buffer()
+    ser.write(b'\x0e')
+    if ser.read(1) != b'\x01':
+        sys.exit('Streaming capture not supported')
+
+    data = bytearray()
+    print('Capturing, Ctrl-C to stop', file=sys.stderr)
+    try:
+        while True:
+            data += ser.read(4096)
+    except KeyboardInterrupt:
+        pass
+    ser.write(b'\0')
+    while True:
+        chunk = ser.read(4096)
+        if not chunk:
+            break
+        data += chunk
+    # Back out to the main loop
+    ser.write(b'\x0f')
+
+    return bytes(data)
+
+
+def varint(data, pos):
+    val = shift = 0
+    while True:
+        b = data[pos]
+        pos += 1
+        val |= (b & 0x7F) << shift
+        shift += 7
+        if not b & 0x80:
+            return val, pos
+
+
+def convert(data, out):
+    out.write('$version Desk Viking streaming capture $end\n')
+    out.write('$timescale 1 ns $end\n')
+    out.write('$scope module desk-viking $end\n')
+    for _, ident, name in PINS:
+        out.write('$var wire 1 %s %s $end\n' % (ident, name))
+    out.write('$upscope $end\n')
+    out.write('$enddefinitions $end\n')
+
+    clock = None
+    cycles = 0
+    state = None
+    dropped = 0
+    pos = 0
+    while pos < len(data):
+        rec = data[pos]
+        pos += 1
+        if rec == REC_END:
+            break
+        val, pos = varint(data, pos)
+        if rec == REC_CLOCK:
+            clock = val
+        elif rec == REC_OVERFLOW:
+            dropped += val
+            out.write('$comment %d transitions dropped $end\n' % val)
+        elif rec & 0x80:
+            sys.exit('Unknown record type 0x%02x at offset %d' %
+                     (rec, pos - 1))
+        else:
+            if clock is None:
+                sys.exit('Stream does not start with a clock record')
+            cycles += val
+            changes = ''.join(' %d%s' % (1 if rec & bit else 0, ident)
+                              for bit, ident, _ in PINS
+                              if state is None or (rec ^ state) & bit)
+            if changes:
+                out.write('#%d%s\n' % (cycles * 1000000000 // clock,
+                                       changes))
+            state = rec
+
+    if dropped:
+        print('Warning: %d transitions dropped' % dropped, file=sys.stderr)
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Convert a Desk Viking streaming capture to VCD')
+    src = parser.add_mutually_exclusive_group(required=True)
+    src.add_argument('--port', help='Capture from this serial device')
+    src.add_argument('--input', help='Convert this raw capture file')
+    parser.add_argument('output', help='VCD file to write')
+    args = parser.parse_args()
+
+    if args.port:
+        data = capture(args.port)
+    else:
+        with open(args.input, 'rb') as f:
+            data = f.read()
+
+    with open(args.output, 'w') as out:
+        convert(data, out)
+
+
+if __name__ == '__main__':
+    main()